@@ -0,0 +1,227 @@
+
+#ifndef BLAS_MPI
+#define BLAS_MPI
+
+/* Distributed BLAS-1 library, Version 1
+ *
+ * Block-distributed double precision vectors and the
+ * level-1 operations on them. Each process allocates and
+ * touches only its own block, as given by the block
+ * decomposition macros of helpersMPI.h. The local kernels
+ * are OpenMP/SIMD loops; fused kernels compute several
+ * results in one pass over memory, and reductions can be
+ * deferred so that several of them share one allreduce.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <math.h>
+#include "helpersMPI.h"
+
+#define MAX_PENDING	32	/* Reductions per batch */
+
+/* A vector of 'n' elements, block distributed in 'comm' */
+typedef struct {
+  long long n;		/* Global length */
+  long long low;	/* Global index of v[0] */
+  int size;		/* Elements on this process */
+  double *v;		/* Local block */
+  MPI_Comm comm;	/* Communicator */
+} block_vector;
+
+/* Scalar reductions waiting for a common allreduce */
+typedef struct {
+  double value[MAX_PENDING];	/* Local partial sums */
+  double *result[MAX_PENDING];	/* Where the results go */
+  int is_norm[MAX_PENDING];	/* Take square root of result */
+  int cnt;			/* Reductions pending */
+  MPI_Comm comm;		/* Communicator */
+} reduction_batch;
+
+/*
+ * Allocate the local block of a vector of 'n' elements
+ * block distributed among the processes of 'comm'
+ */
+void create_block_vector(
+  long long n,		/* IN - Global length */
+  MPI_Comm comm,	/* IN - Communicator */
+  block_vector *x)	/* OUT - Vector */
+{
+  int id;		/* Process rank */
+  int p;		/* Number of processes */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  x->n = n;
+  x->low = block_low(id, p, n, comm);
+  x->size = block_size(id, p, n, comm);
+  x->comm = comm;
+  x->v = (double *)my_malloc(id, (x->size ? (size_t) x->size : 1) * sizeof(double));
+}
+
+void free_block_vector(block_vector *x)
+{
+  my_free(x->v);
+  x->v = NULL;
+}
+
+/* Local kernels: operate on this process's block only */
+
+double local_dot(block_vector *x, block_vector *y)
+{
+  double s = 0.0;
+  int i;
+
+#pragma omp parallel for simd reduction(+:s)
+  for(i = 0; i < x->size; i++) s += x->v[i] * y->v[i];
+  return s;
+}
+
+/*
+ * Fused: x.y and y.y in one pass over both blocks
+ */
+void local_dot_sqnorm(block_vector *x, block_vector *y, double *dot, double *sqnorm)
+{
+  double d = 0.0, q = 0.0;
+  int i;
+
+#pragma omp parallel for simd reduction(+:d,q)
+  for(i = 0; i < x->size; i++) {
+    d += x->v[i] * y->v[i];
+    q += y->v[i] * y->v[i];
+  }
+  *dot = d;
+  *sqnorm = q;
+}
+
+/*
+ * y <- a*x + y
+ */
+void block_axpy(double a, block_vector *x, block_vector *y)
+{
+  int i;
+
+#pragma omp parallel for simd
+  for(i = 0; i < x->size; i++) y->v[i] += a * x->v[i];
+}
+
+/*
+ * x <- a*x
+ */
+void block_scal(double a, block_vector *x)
+{
+  int i;
+
+#pragma omp parallel for simd
+  for(i = 0; i < x->size; i++) x->v[i] *= a;
+}
+
+/*
+ * Fused: y <- a*x + y, returning the local part of y.z
+ * computed on the updated values in the same pass
+ */
+double local_axpy_dot(double a, block_vector *x, block_vector *y, block_vector *z)
+{
+  double s = 0.0;
+  int i;
+
+#pragma omp parallel for simd reduction(+:s)
+  for(i = 0; i < x->size; i++) {
+    y->v[i] += a * x->v[i];
+    s += y->v[i] * z->v[i];
+  }
+  return s;
+}
+
+/* Global operations: each costs one (hierarchical) allreduce */
+
+double block_dot(block_vector *x, block_vector *y)
+{
+  double local, global;
+
+  local = local_dot(x, y);
+  hier_allreduce(&local, &global, 1, MPI_DOUBLE, MPI_SUM, x->comm);
+  return global;
+}
+
+double block_nrm2(block_vector *x)
+{
+  return sqrt(block_dot(x, x));
+}
+
+/*
+ * x.y and ||y|| with one pass and one allreduce
+ */
+void block_dot_nrm2(block_vector *x, block_vector *y, double *dot, double *nrm)
+{
+  double local[2], global[2];
+
+  local_dot_sqnorm(x, y, &local[0], &local[1]);
+  hier_allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, x->comm);
+  *dot = global[0];
+  *nrm = sqrt(global[1]);
+}
+
+/* Deferred reductions: the local part is computed at once,
+ * the results become valid after 'flush_reductions'
+ */
+
+void init_reductions(reduction_batch *r, MPI_Comm comm)
+{
+  r->cnt = 0;
+  r->comm = comm;
+}
+
+/*
+ * Queue a local partial sum whose global sum goes to
+ * 'result' (its square root if 'is_norm'). A full batch is
+ * flushed first
+ */
+void defer_sum(reduction_batch *r, double local, double *result, int is_norm)
+{
+  void flush_reductions(reduction_batch *);
+
+  if(r->cnt == MAX_PENDING) flush_reductions(r);
+  r->value[r->cnt] = local;
+  r->result[r->cnt] = result;
+  r->is_norm[r->cnt++] = is_norm;
+}
+
+void defer_dot(reduction_batch *r, block_vector *x, block_vector *y, double *result)
+{
+  defer_sum(r, local_dot(x, y), result, 0);
+}
+
+void defer_nrm2(reduction_batch *r, block_vector *x, double *result)
+{
+  defer_sum(r, local_dot(x, x), result, 1);
+}
+
+/*
+ * Fused: x.y and ||y|| from one pass, reduced with the batch
+ */
+void defer_dot_nrm2(reduction_batch *r, block_vector *x, block_vector *y, double *dot, double *nrm)
+{
+  double d, q;
+
+  local_dot_sqnorm(x, y, &d, &q);
+  defer_sum(r, d, dot, 0);
+  defer_sum(r, q, nrm, 1);
+}
+
+/*
+ * Complete all pending reductions with a single allreduce
+ */
+void flush_reductions(reduction_batch *r)
+{
+  double global[MAX_PENDING];
+  int i;
+
+  if(!r->cnt) return;
+  hier_allreduce(r->value, global, r->cnt, MPI_DOUBLE, MPI_SUM, r->comm);
+  for(i = 0; i < r->cnt; i++)
+    *(r->result[i]) = r->is_norm[i] ? sqrt(global[i]) : global[i];
+  r->cnt = 0;
+}
+
+#endif
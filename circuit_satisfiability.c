@@ -1,6 +1,7 @@
 
 #include <mpi.h>
 #include <stdio.h>
+#include "solutionsMPI.h"
 
 /*
  * Circuit Satisfiability, Version 1
@@ -12,6 +13,12 @@
  * logic of function 'check_circuit'. All combinations of
  * inputs that satisfy the circuit are printed.
  * 
+ * Solutions are kept in a buffer and printed by process 0
+ * once the search is over ('-quiet' skips that); '-o file'
+ * also writes them to a file (see solutionsMPI.h).
+ * 
+ * Usage: circuit_satisfiability [-quiet] [-o file]
+ * 
  * Programmed by Michael Quinn
  * 
  * Last modification: 3 September 2002
@@ -20,7 +27,7 @@
 /* Return 1 if 'i'th bit of 'n' is 1; 0 otherwise */
 #define EXTRACT_BIT(n,i) ((n&(1<<i))?1:0)
 
-void check_circuit(int id, int z) {
+void check_circuit(int id, int z, solution_buffer *s) {
   int v[16];	/* Each element is a bit of 'z' */
   int i;
   
@@ -35,10 +42,7 @@ void check_circuit(int id, int z) {
     && (v[9] || v[11]) && (v[10] || v[11])
     && (v[12] || v[13]) && (v[13] || !v[14])
     && (v[14] || v[15])) {
-      printf("%d) %d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d\n", id,
-	v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],v[8],v[9],
-	v[10],v[11],v[12],v[13],v[14],v[15]);
-      fflush(stdout);
+      add_solution(s, z);
     }
 }
 
@@ -47,16 +51,23 @@ int main(int argc, char * argv[]) {
   int i;
   int id;	/* Process rank */
   int p;	/* Number of processes */
-  void check_circuit(int, int);
+  void check_circuit(int, int, solution_buffer *);
+  solution_buffer found;	/* Solutions of this proc */
+  int print = 1;	/* Print the solutions */
+  char *name = NULL;	/* File for the solutions */
   
   /* call this before any other MPI functions */
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  solution_options(argc, argv, &print, &name);
+  init_solutions(&found);
   
   for(i = id; i < 65536; i += p)
-   check_circuit(id, i); 
+   check_circuit(id, i, &found);
   
+  output_solutions(&found, 16, print, name, MPI_COMM_WORLD);
+  free_solutions(&found);
   printf("Process %d is done\n", id);
   fflush(stdout);
   MPI_Finalize();
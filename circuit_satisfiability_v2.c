@@ -1,6 +1,7 @@
 
 #include <mpi.h>
 #include <stdio.h>
+#include "solutionsMPI.h"
 
 /*
  * Circuit Satisfiability, Version 2
@@ -12,6 +13,12 @@
  * logic of function 'check_circuit'. All combinations of
  * inputs that satisfy the circuit are printed.
  * 
+ * Solutions are kept in a buffer and printed by process 0
+ * once the search is over ('-quiet' skips that); '-o file'
+ * also writes them to a file (see solutionsMPI.h).
+ * 
+ * Usage: circuit_satisfiability_v2 [-quiet] [-o file]
+ * 
  * Programmed by Dmitriy Rybalkin <dmitriy.rybalkin@gmail.com>
  * 
  * Last modification: 06 May 2016
@@ -23,7 +30,7 @@
 /* Return 1 if 'i'th bit of 'n' is 1; 0 otherwise */
 #define EXTRACT_BIT(n,i) ((n&(1<<i))?1:0)
 
-int check_circuit(int id, int z) {
+int check_circuit(int id, int z, solution_buffer *s) {
   int v[16];	/* Each element is a bit of 'z' */
   int i;
   int count_solution = 0;
@@ -39,10 +46,7 @@ int check_circuit(int id, int z) {
     && (v[9] || v[11]) && (v[10] || v[11])
     && (v[12] || v[13]) && (v[13] || !v[14])
     && (v[14] || v[15])) {
-      printf("%d) %d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d\n", id,
-	v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],v[8],v[9],
-	v[10],v[11],v[12],v[13],v[14],v[15]);
-      fflush(stdout);
+      add_solution(s, z);
       count_solution++;
     }
     return count_solution;
@@ -55,17 +59,22 @@ int main(int argc, char * argv[]) {
   int id;		/* Process rank */
   int p;		/* Number of processes */
   int solutions;	/* Solutions found by this proc */
-  int check_circuit(int, int);
+  int check_circuit(int, int, solution_buffer *);
+  solution_buffer found;	/* Solutions of this proc */
+  int print = 1;	/* Print the solutions */
+  char *name = NULL;	/* File for the solutions */
   
   /* call this before any other MPI functions */
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  solution_options(argc, argv, &print, &name);
+  init_solutions(&found);
   
   solutions = 0;
   
   for(i = id; i < 65536; i += p)
-   solutions += check_circuit(id, i); 
+   solutions += check_circuit(id, i, &found);
   
   /*
    * Function MPI_Reduce performs
@@ -83,6 +92,8 @@ int main(int argc, char * argv[]) {
    * )
    */
   MPI_Reduce(&solutions, &global_solutions, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+  output_solutions(&found, 16, print, name, MPI_COMM_WORLD);
+  free_solutions(&found);
   
   printf("Process %d is done\n", id);
   fflush(stdout);
@@ -1,6 +1,8 @@
 
 #include <mpi.h>
 #include <stdio.h>
+#include "solutionsMPI.h"
+#include <string.h>
 
 /*
  * Circuit Satisfiability, Version 3
@@ -21,12 +23,28 @@
  * 
  * Also amended with elapsed time measuring functions
  * double MPI_Wtime, double MPI_Wtick. Commented out printf and fflush within function check_circuit to avoid counting I/O time
+ * 
+ * With '-first' the search stops at the first solution
+ * found by any process: it is swapped into a flag on
+ * process 0 with MPI_Compare_and_swap, and the other
+ * processes read the flag every CHUNK assignments and stop
+ * once it is set. The solution, its finder and the time to
+ * find it are printed.
+ * 
+ * Solutions are kept in a buffer during the timed search;
+ * '-print' has process 0 print them afterwards and '-o file'
+ * writes them to a file (see solutionsMPI.h).
+ * 
+ * Usage: circuit_satisfiability_v3 [-first] [-print] [-o file]
  */
 
 /* Return 1 if 'i'th bit of 'n' is 1; 0 otherwise */
 #define EXTRACT_BIT(n,i) ((n&(1<<i))?1:0)
 
-int check_circuit(int id, int z) {
+#define CHUNK 256	/* Assignments between reads of the flag */
+#define NONE -1		/* Flag before any solution */
+
+int check_circuit(int id, int z, solution_buffer *s) {
   int v[16];	/* Each element is a bit of 'z' */
   int i;
   int count_solution = 0;
@@ -42,15 +60,69 @@ int check_circuit(int id, int z) {
     && (v[9] || v[11]) && (v[10] || v[11])
     && (v[12] || v[13]) && (v[13] || !v[14])
     && (v[14] || v[15])) {
-      /*printf("%d) %d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d\n", id,
-	v[0],v[1],v[2],v[3],v[4],v[5],v[6],v[7],v[8],v[9],
-	v[10],v[11],v[12],v[13],v[14],v[15]);
-      fflush(stdout);*/
+      if(s != NULL) add_solution(s, z);
       count_solution++;
     }
     return count_solution;
 }
 
+/*
+ * Check the assignments of process 'id' until it or another
+ * process finds a solution. Returns the solution, NONE if
+ * there is none; sets '*won' if this process found it
+ * first, with the seconds since 'start' in '*found_at', and
+ * '*checked' to the assignments it checked.
+ * 
+ * All processes must invoke this function together
+ */
+int search_first(int id, int p, double start, int *won, double *found_at, int *checked)
+{
+  MPI_Win win;
+  int *flag;		/* On process 0: first solution, or NONE */
+  int none = NONE;
+  int seen = NONE;	/* Flag as last read */
+  int old;		/* Flag before our swap */
+  int i, k;
+
+  MPI_Win_allocate(id ? 0 : sizeof(int), sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &flag, &win);
+  MPI_Win_lock_all(0, win);
+  if(!id) {
+    *flag = NONE;
+    MPI_Win_sync(win);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  *won = 0;
+  *checked = 0;
+  for(i = id; i < 65536 && seen == NONE; ) {
+    for(k = 0; k < CHUNK && i < 65536; k++, i += p) {
+      (*checked)++;
+      if(check_circuit(id, i, NULL)) {
+	MPI_Compare_and_swap(&i, &none, &old, MPI_INT, 0, 0, win);
+	MPI_Win_flush(0, win);
+	if(old == NONE) {
+	  *found_at = MPI_Wtime() - start;
+	  *won = 1;
+	  seen = i;
+	} else seen = old;
+	break;
+      }
+    }
+    if(seen == NONE) {
+      MPI_Fetch_and_op(NULL, &seen, MPI_INT, 0, 0, MPI_NO_OP, win);
+      MPI_Win_flush(0, win);
+    }
+  }
+
+  /* A late finder may still swap: read the flag once all are done */
+  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Fetch_and_op(NULL, &seen, MPI_INT, 0, 0, MPI_NO_OP, win);
+  MPI_Win_flush(0, win);
+  MPI_Win_unlock_all(win);
+  MPI_Win_free(&win);
+  return seen;
+}
+
 int main(int argc, char * argv[]) {
 
   int global_solutions;	/* Total number of solutions */
@@ -58,8 +130,21 @@ int main(int argc, char * argv[]) {
   int id;		/* Process rank */
   int p;		/* Number of processes */
   int solutions;	/* Solutions found by this proc */
-  int check_circuit(int, int);
+  int check_circuit(int, int, solution_buffer *);
+  solution_buffer found;	/* Solutions of this proc */
+  int print = 0;	/* Print the solutions */
+  char *name = NULL;	/* File for the solutions */
   double elapsed_time;
+  int first = 0;	/* Stop at the first solution */
+  int solution;		/* First solution found */
+  int won;		/* This process found it */
+  int winner;		/* Process that found it */
+  int checked;		/* Assignments checked here */
+  int total_checked;	/* By all processes */
+  double found_at = 0.0;	/* Seconds to the first solution */
+  
+  for(i = 1; i < argc; i++)
+    if(!strcmp(argv[i], "-first")) first = 1;
   
   /* call this before any other MPI functions */
   MPI_Init(&argc, &argv);
@@ -69,11 +154,34 @@ int main(int argc, char * argv[]) {
   
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  solution_options(argc, argv, &print, &name);
+  init_solutions(&found);
+  
+  if(first) {
+    solution = search_first(id, p, -elapsed_time, &won, &found_at, &checked);
+    winner = won ? id : -1;
+    MPI_Allreduce(MPI_IN_PLACE, &winner, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if(winner >= 0) MPI_Bcast(&found_at, 1, MPI_DOUBLE, winner, MPI_COMM_WORLD);
+    MPI_Reduce(&checked, &total_checked, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    elapsed_time += MPI_Wtime();
+    if(!id) {
+      if(solution == NONE) printf("The circuit is not satisfiable\n");
+      else {
+	printf("First solution: ");
+	for(i = 0; i < 16; i++) printf("%d", EXTRACT_BIT(solution, i));
+	printf(", found by process %d after %f s\n", winner, found_at);
+      }
+      printf("%d of 65536 assignments checked in %f s\n", total_checked, elapsed_time);
+      fflush(stdout);
+    }
+    MPI_Finalize();
+    return 0;
+  }
   
   solutions = 0;
   
   for(i = id; i < 65536; i += p)
-   solutions += check_circuit(id, i); 
+   solutions += check_circuit(id, i, &found);
   
   /*
    * Function MPI_Reduce performs
@@ -93,6 +201,10 @@ int main(int argc, char * argv[]) {
   MPI_Reduce(&solutions, &global_solutions, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
   elapsed_time += MPI_Wtime();
   
+  /* Output after the timed part */
+  output_solutions(&found, 16, print, name, MPI_COMM_WORLD);
+  free_solutions(&found);
+  
   printf("Process %d is done\n", id);
   fflush(stdout);
   
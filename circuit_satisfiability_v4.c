@@ -0,0 +1,316 @@
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "solutionsMPI.h"
+
+/*
+ * Circuit Satisfiability, Version 4
+ *
+ * Counts (and keeps) every assignment satisfying a formula
+ * in conjunctive normal form of up to 64 inputs: the circuit
+ * of the earlier versions, written as 18 two-literal
+ * clauses, or one read from a DIMACS file.
+ *
+ * The 2^n assignments are split into one block of
+ * consecutive indices per process, and each block is walked
+ * in Gray-code order: assignment k is k ^ (k >> 1), so
+ * going from k - 1 to k flips only input ctz(k). Every
+ * clause keeps the number of its literals that are true;
+ * a flip updates only the clauses holding that input, and
+ * the formula is satisfied when no clause has a count of 0.
+ * A step costs O(occurrences of one input) instead of a
+ * re-evaluation of the whole formula.
+ *
+ * Each process reports its assignments, time and
+ * throughput; '-progress s' also has it report its progress
+ * every s seconds. Solutions are handled as in version 3
+ * (see solutionsMPI.h).
+ *
+ * Usage: circuit_satisfiability_v4 [file.cnf] [-progress s] [-print] [-o file]
+ *
+ * Last modification: 18 October 2026
+ */
+
+#define MAX_VARS	64
+#define PROGRESS_STEPS	(1 << 22)	/* Steps between looks at the clock */
+
+/* Formula in conjunctive normal form */
+typedef struct {
+  int vars;		/* Inputs */
+  int clauses;		/* Clauses */
+  int *start;		/* First literal of each clause; clauses + 1 */
+  int *lits;		/* Literals: input i is i + 1, its negation -(i + 1) */
+} cnf;
+
+/* The circuit of versions 1 to 3 */
+int circuit_lits[] = {
+  1, 2,  -2, -4,  3, 4,  -4, -5,  5, -6,  6, -7,  6, 7,  7, -16,  8, -9,
+  -8, -14,  9, 10,  9, -10,  -10, -11,  10, 12,  11, 12,  13, 14,  14, -15,  15, 16
+};
+
+void builtin_circuit(cnf *f)
+{
+  int i;
+
+  f->vars = 16;
+  f->clauses = 18;
+  f->start = malloc((f->clauses + 1) * sizeof(int));
+  f->lits = malloc(2 * f->clauses * sizeof(int));
+  for(i = 0; i <= f->clauses; i++) f->start[i] = 2 * i;
+  memcpy(f->lits, circuit_lits, 2 * f->clauses * sizeof(int));
+}
+
+/*
+ * Read a DIMACS file ("p cnf vars clauses", then clauses as
+ * literals ending in 0; lines starting with 'c' are
+ * comments). Returns 0 on failure
+ */
+int read_dimacs(const char *name, cnf *f)
+{
+  FILE *in;
+  char line[256];
+  int c, n = 0, cap, lit;
+
+  if((in = fopen(name, "r")) == NULL) return 0;
+  f->vars = f->clauses = -1;
+  while(fgets(line, sizeof(line), in) != NULL)
+    if(line[0] == 'p') {
+      if(sscanf(line, "p cnf %d %d", &f->vars, &f->clauses) != 2) f->vars = -1;
+      break;
+    }
+  if(f->vars < 1 || f->vars > MAX_VARS || f->clauses < 0) {
+    fclose(in);
+    return 0;
+  }
+  cap = 4 * f->clauses + 4;
+  f->start = malloc((f->clauses + 1) * sizeof(int));
+  f->lits = malloc(cap * sizeof(int));
+  f->start[0] = 0;
+  for(c = 0; c < f->clauses && fscanf(in, "%d", &lit) == 1; ) {
+    if(!lit) {
+      f->start[++c] = n;
+      continue;
+    }
+    if(lit > f->vars || -lit > f->vars) {
+      fclose(in);
+      return 0;
+    }
+    if(n == cap) f->lits = realloc(f->lits, (cap *= 2) * sizeof(int));
+    f->lits[n++] = lit;
+  }
+  fclose(in);
+  return c == f->clauses;
+}
+
+/* Input flipped between Gray codes k - 1 and k */
+int flipped_input(uint64_t k)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll(k);
+#else
+  int i = 0;
+  while(!(k & 1)) {
+    k >>= 1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+/*
+ * First index of process 'id' among the 2^vars
+ * assignments; process p's is 2^vars, which for 64 inputs
+ * wraps to 0
+ */
+uint64_t range_low(int id, int p, int vars)
+{
+  uint64_t q, r;	/* 2^vars = q * p + r */
+
+  if(vars < 64) {
+    q = ((uint64_t) 1 << vars) / p;
+    r = ((uint64_t) 1 << vars) % p;
+  } else {
+    q = UINT64_MAX / p;
+    r = UINT64_MAX % p + 1;
+    if(r == (uint64_t) p) {
+      q++;
+      r = 0;
+    }
+  }
+  return (uint64_t) id * q + ((uint64_t) id < r ? (uint64_t) id : r);
+}
+
+/*
+ * Walk assignments 'low' to 'last' (inclusive) in Gray-code
+ * order, adding the satisfying ones to 's'. Returns the
+ * steps taken
+ */
+uint64_t gray_search(
+  cnf *f,		/* IN - Formula */
+  uint64_t low,		/* IN - First index */
+  uint64_t last,	/* IN - Last index */
+  solution_buffer *s,	/* OUT - Solutions */
+  int id,		/* IN - Process rank */
+  double progress)	/* IN - Seconds between reports; 0: none */
+{
+  int *occ_start;	/* First occurrence of each input */
+  int *fill;		/* Next free occurrence of each input */
+  int *occ;		/* Clauses holding each input, negated if the literal is */
+  int *sat;		/* True literals of each clause */
+  int unsat = 0;	/* Clauses with none */
+  uint64_t z;		/* Current assignment */
+  uint64_t k = low, steps = 1;
+  double t0, next_report;
+  int c, i, j, v, b;
+
+  /* Occurrence lists, input v's in occ[occ_start[v] .. occ_start[v + 1]) */
+  occ_start = calloc(f->vars + 1, sizeof(int));
+  fill = malloc((f->vars + 1) * sizeof(int));
+  occ = malloc((f->start[f->clauses] + 1) * sizeof(int));
+  for(i = 0; i < f->start[f->clauses]; i++) occ_start[abs(f->lits[i])]++;
+  for(v = 0; v < f->vars; v++) fill[v] = occ_start[v + 1] += occ_start[v];
+  for(v = f->vars - 1; v > 0; v--) fill[v] = fill[v - 1];
+  fill[0] = 0;
+  for(c = 0; c < f->clauses; c++)	/* Clause c stored as c + 1, so it can be negated */
+    for(i = f->start[c]; i < f->start[c + 1]; i++)
+      occ[fill[abs(f->lits[i]) - 1]++] = f->lits[i] > 0 ? c + 1 : -(c + 1);
+  free(fill);
+
+  /* Counters for the first assignment */
+  z = low ^ (low >> 1);
+  sat = malloc((f->clauses + 1) * sizeof(int));
+  for(c = 0; c < f->clauses; c++) {
+    sat[c] = 0;
+    for(i = f->start[c]; i < f->start[c + 1]; i++) {
+      b = (z >> (abs(f->lits[i]) - 1)) & 1;
+      if(b == (f->lits[i] > 0)) sat[c]++;
+    }
+    if(!sat[c]) unsat++;
+  }
+  if(!unsat) add_solution(s, z);
+
+  t0 = MPI_Wtime();
+  next_report = progress;
+  while(k != last) {
+    k++;
+    v = flipped_input(k);
+    z ^= (uint64_t) 1 << v;
+    b = (z >> v) & 1;
+    for(j = occ_start[v]; j < occ_start[v + 1]; j++) {
+      c = occ[j];
+      if((c > 0) == b) {	/* Literal became true */
+	if(!sat[abs(c) - 1]++) unsat--;
+      } else if(!--sat[abs(c) - 1]) unsat++;
+    }
+    if(!unsat) add_solution(s, z);
+    if(progress > 0.0 && !(++steps % PROGRESS_STEPS) && MPI_Wtime() - t0 >= next_report) {
+      printf("Process %d: %.1f%% of its range, %.1f M assignments/s\n", id,
+	     100.0 * (double) (k - low) / ((double) (last - low) + 1.0),
+	     (double) (k - low) / (MPI_Wtime() - t0) / 1e6);
+      fflush(stdout);
+      next_report += progress;
+    }
+  }
+  free(sat);
+  free(occ);
+  free(occ_start);
+  return last - low + 1;
+}
+
+int main(int argc, char * argv[]) {
+
+  cnf f;		/* Formula */
+  int n[2];		/* Inputs, clauses */
+  int id;		/* Process rank */
+  int p;		/* Number of processes */
+  int i;
+  int ok = 1;		/* Formula read */
+  char *cnf_name = NULL;
+  double progress = 0.0;	/* Seconds between progress reports */
+  uint64_t low, last;	/* This process's assignments */
+  double steps;		/* Assignments checked */
+  double elapsed_time;
+  double stats[3];	/* Assignments, seconds, solutions */
+  double *all = NULL;	/* Stats of all processes */
+  long long global_solutions;
+  solution_buffer found;	/* Solutions of this proc */
+  int print = 0;	/* Print the solutions */
+  char *name = NULL;	/* File for the solutions */
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  solution_options(argc, argv, &print, &name);
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-progress") && i + 1 < argc) progress = atof(argv[++i]);
+    else if(!strcmp(argv[i], "-o")) i++;
+    else if(argv[i][0] != '-') cnf_name = argv[i];
+  }
+
+  /* Process 0 reads the formula and broadcasts it */
+  if(!id) {
+    if(cnf_name != NULL) ok = read_dimacs(cnf_name, &f);
+    else builtin_circuit(&f);
+    n[0] = ok ? f.vars : 0;
+    n[1] = ok ? f.clauses : 0;
+  }
+  MPI_Bcast(n, 2, MPI_INT, 0, MPI_COMM_WORLD);
+  if(!n[0]) {
+    if(!id) printf("Cannot read a formula of 1 to %d inputs from %s\n", MAX_VARS, cnf_name);
+    MPI_Finalize();
+    return 1;
+  }
+  if(id) {
+    f.vars = n[0];
+    f.clauses = n[1];
+    f.start = malloc((f.clauses + 1) * sizeof(int));
+  }
+  MPI_Bcast(f.start, f.clauses + 1, MPI_INT, 0, MPI_COMM_WORLD);
+  if(id) f.lits = malloc((f.start[f.clauses] + 1) * sizeof(int));
+  MPI_Bcast(f.lits, f.start[f.clauses], MPI_INT, 0, MPI_COMM_WORLD);
+
+  init_solutions(&found);
+  low = range_low(id, p, f.vars);
+  last = range_low(id + 1, p, f.vars) - 1;
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  elapsed_time = -MPI_Wtime();
+  steps = 0.0;
+  stats[1] = -MPI_Wtime();
+  if(f.vars >= 63 || (uint64_t) id < ((uint64_t) 1 << f.vars))	/* Fewer assignments than processes */
+    steps = (double) gray_search(&f, low, last, &found, id, progress);
+  stats[1] += MPI_Wtime();
+  stats[0] = steps;
+  stats[2] = found.count;
+  MPI_Barrier(MPI_COMM_WORLD);
+  elapsed_time += MPI_Wtime();
+
+  if(!id) all = malloc(3 * p * sizeof(double));
+  MPI_Gather(stats, 3, MPI_DOUBLE, all, 3, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+  if(!id) {
+    printf("%d inputs, %d clauses\n", f.vars, f.clauses);
+    printf("Rank  Assignments    Seconds  M assignments/s  Solutions\n");
+    for(i = 0; i < p; i++)
+      printf("%4d %12.0f %10.6f %16.2f %10.0f\n", i, all[3 * i], all[3 * i + 1],
+	     all[3 * i + 1] > 0.0 ? all[3 * i] / all[3 * i + 1] / 1e6 : 0.0, all[3 * i + 2]);
+    fflush(stdout);
+    free(all);
+  }
+
+  /* Output after the timed part */
+  global_solutions = output_solutions(&found, f.vars, print, name, MPI_COMM_WORLD);
+  if(!id) {
+    printf("Elapsed time is %f\n", elapsed_time);
+    printf("There are %lld different solutions\n", global_solutions);
+    fflush(stdout);
+  }
+
+  free_solutions(&found);
+  free(f.start);
+  free(f.lits);
+  MPI_Finalize();
+  return 0;
+}
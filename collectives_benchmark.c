@@ -0,0 +1,115 @@
+/* Collectives benchmark, Version 1
+ *
+ * Times the flat MPI collectives against the two-level
+ * ('hier_') versions of helpersMPI.h for message sizes
+ * from 8 bytes up to the given maximum. Sizes are totals:
+ * the whole vector for bcast and allreduce, the sum of all
+ * blocks for allgatherv and scatterv. Each time is the
+ * slowest process's average over the repetitions.
+ *
+ * Usage: collectives_benchmark [max_bytes]
+ *
+ * Run across several nodes to see the difference: on one
+ * node the two-level versions only add an extra step.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include "helpersMPI.h"
+
+#define MAX_BYTES	(16 * 1024 * 1024)
+#define TARGET_BYTES	(256 * 1024 * 1024)	/* Per size and operation */
+
+enum { BCAST, ALLREDUCE, ALLGATHERV, SCATTERV, OPS };
+
+char *op_name[OPS] = { "bcast", "allreduce", "allgatherv", "scatterv" };
+
+/*
+ * Run operation 'op' on 'n' doubles 'reps' times, flat or
+ * hierarchical; returns the slowest process's seconds per call
+ */
+double time_op(int op, int hier, int n, int reps, double *a, double *b, int *cnt, int *disp, MPI_Comm comm)
+{
+  int i, id;
+  double t, slowest;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Barrier(comm);
+  t = -MPI_Wtime();
+  for(i = 0; i < reps; i++) {
+    switch(op) {
+    case BCAST:
+      if(hier) hier_bcast(a, n, MPI_DOUBLE, 0, comm);
+      else MPI_Bcast(a, n, MPI_DOUBLE, 0, comm);
+      break;
+    case ALLREDUCE:
+      if(hier) hier_allreduce(a, b, n, MPI_DOUBLE, MPI_SUM, comm);
+      else MPI_Allreduce(a, b, n, MPI_DOUBLE, MPI_SUM, comm);
+      break;
+    case ALLGATHERV:
+      if(hier) hier_allgatherv(a, cnt[id], MPI_DOUBLE, b, cnt, disp, comm);
+      else MPI_Allgatherv(a, cnt[id], MPI_DOUBLE, b, cnt, disp, MPI_DOUBLE, comm);
+      break;
+    case SCATTERV:
+      if(hier) hier_scatterv(a, cnt, disp, MPI_DOUBLE, b, cnt[id], 0, comm);
+      else MPI_Scatterv(a, cnt, disp, MPI_DOUBLE, b, cnt[id], MPI_DOUBLE, 0, comm);
+      break;
+    }
+  }
+  t += MPI_Wtime();
+  t /= reps;
+  MPI_Allreduce(&t, &slowest, 1, MPI_DOUBLE, MPI_MAX, comm);
+  return slowest;
+}
+
+int main(int argc, char *argv[])
+{
+  double *a, *b;	/* Send and receive buffers */
+  int *cnt, *disp;	/* Blocks of allgatherv/scatterv */
+  double flat, hier;	/* Seconds per call */
+  hier_info *h;
+  int i, id, p;
+  long max_bytes;	/* Largest message */
+  int n;		/* Doubles per message */
+  int op;
+  int reps;		/* Repetitions */
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+
+  max_bytes = argc > 1 ? atol(argv[1]) : MAX_BYTES;
+  if(max_bytes < (long) sizeof(double)) max_bytes = sizeof(double);
+  a = my_malloc(id, max_bytes);
+  b = my_malloc(id, max_bytes);
+  for(i = 0; i < max_bytes / (long) sizeof(double); i++) a[i] = id + i;
+  h = get_hier_info(MPI_COMM_WORLD);
+
+  if(!id) {
+    printf("%d processes on %d nodes\n", p, h->nodes);
+    printf("%10s %-11s %12s %12s %8s\n", "Bytes", "Operation", "Flat us", "Hier us", "Speedup");
+  }
+  for(n = 1; (long) (n * sizeof(double)) <= max_bytes; n *= 4) {
+    create_mixed_xfer_arrays(id, p, n, MPI_COMM_WORLD, &cnt, &disp);
+    reps = TARGET_BYTES / (n * sizeof(double) * p);
+    if(reps < 5) reps = 5;
+    if(reps > 1000) reps = 1000;
+    for(op = 0; op < OPS; op++) {
+      time_op(op, 1, n, 1, a, b, cnt, disp, MPI_COMM_WORLD);	/* Warm up */
+      flat = time_op(op, 0, n, reps, a, b, cnt, disp, MPI_COMM_WORLD);
+      hier = time_op(op, 1, n, reps, a, b, cnt, disp, MPI_COMM_WORLD);
+      if(!id)
+	printf("%10ld %-11s %12.2f %12.2f %8.2f\n", (long) n * sizeof(double), op_name[op],
+	       flat * 1e6, hier * 1e6, flat / hier);
+    }
+  }
+  fflush(stdout);
+
+  my_free(a);
+  my_free(b);
+  my_finalize();
+  return 0;
+}
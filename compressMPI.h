@@ -0,0 +1,266 @@
+
+#ifndef COMPRESS_MPI
+#define COMPRESS_MPI
+
+/* Payload compression library, Version 1
+ *
+ * Codecs for the data of large transfers, used by the
+ * collectives of helpersMPI.h when compression is turned
+ * on:
+ * - integers: each element's difference from the previous
+ *   one, zigzag mapped and written as a LEB128 varint
+ *   (lossless; small or slowly varying values take 1 byte)
+ * - doubles, lossless: byte shuffle (the first bytes of all
+ *   elements, then the second bytes, ...) and PackBits
+ *   run-length coding, which removes the runs of equal
+ *   sign/exponent bytes and of zero mantissa bytes
+ * - doubles, lossy: float, or bfloat16 rounded to nearest
+ *   even
+ * A payload starts with one byte naming its code. Data that
+ * would not shrink is stored raw.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+/* Compression modes */
+#define COMPRESS_NONE		0
+#define COMPRESS_LOSSLESS	1
+#define COMPRESS_FLOAT		2
+#define COMPRESS_BF16		3
+
+/* Payload codes */
+#define CODE_RAW		0
+#define CODE_VARINT		1
+#define CODE_SHUFFLE_RLE	2
+#define CODE_FLOAT		3
+#define CODE_BF16		4
+
+/*
+ * Bytes enough for the payload of 'n' elements of 'width'
+ * bytes, whatever the code
+ */
+size_t compress_bound(size_t n, size_t width)
+{
+  return 16 + 2 * n * width;
+}
+
+/*
+ * Delta, zigzag and varint code 'n' integers; returns the
+ * bytes written
+ */
+size_t varint_encode(const int *v, size_t n, unsigned char *out)
+{
+  uint32_t d, prev = 0, z;
+  size_t i, o = 0;
+
+  for(i = 0; i < n; i++) {
+    d = (uint32_t) v[i] - prev;
+    prev = (uint32_t) v[i];
+    z = (d << 1) ^ (uint32_t) -(int32_t) (d >> 31);
+    while(z >= 0x80) {
+      out[o++] = (unsigned char) (z | 0x80);
+      z >>= 7;
+    }
+    out[o++] = (unsigned char) z;
+  }
+  return o;
+}
+
+void varint_decode(const unsigned char *in, size_t n, int *v)
+{
+  uint32_t prev = 0, z;
+  size_t i;
+  int shift;
+
+  for(i = 0; i < n; i++) {
+    z = 0;
+    shift = 0;
+    do {
+      z |= (uint32_t) (*in & 0x7f) << shift;
+      shift += 7;
+    } while(*in++ & 0x80);
+    prev += (z >> 1) ^ (uint32_t) -(int32_t) (z & 1);
+    v[i] = (int) prev;
+  }
+}
+
+/*
+ * Byte 'b' of element 'i' goes to out[b * n + i]
+ */
+void shuffle_bytes(const unsigned char *in, size_t n, size_t width, unsigned char *out)
+{
+  size_t b, i;
+
+  for(i = 0; i < n; i++)
+    for(b = 0; b < width; b++) out[b * n + i] = in[i * width + b];
+}
+
+void unshuffle_bytes(const unsigned char *in, size_t n, size_t width, unsigned char *out)
+{
+  size_t b, i;
+
+  for(i = 0; i < n; i++)
+    for(b = 0; b < width; b++) out[i * width + b] = in[b * n + i];
+}
+
+/*
+ * PackBits: a control byte c < 128 is followed by c + 1
+ * literal bytes, c > 128 by one byte repeated 257 - c times.
+ * Returns the bytes written
+ */
+size_t rle_encode(const unsigned char *in, size_t n, unsigned char *out)
+{
+  size_t i = 0, j, o = 0, r;
+
+  while(i < n) {
+    for(r = 1; i + r < n && r < 128 && in[i + r] == in[i]; r++);
+    if(r >= 3) {
+      out[o++] = (unsigned char) (257 - r);
+      out[o++] = in[i];
+      i += r;
+      continue;
+    }
+    for(j = i; j < n && j - i < 128; j++)
+      if(j + 2 < n && in[j] == in[j + 1] && in[j] == in[j + 2]) break;
+    out[o++] = (unsigned char) (j - i - 1);
+    memcpy(out + o, in + i, j - i);
+    o += j - i;
+    i = j;
+  }
+  return o;
+}
+
+void rle_decode(const unsigned char *in, size_t len, unsigned char *out)
+{
+  const unsigned char *end = in + len;
+  int c;
+
+  while(in < end) {
+    c = *in++;
+    if(c < 128) {
+      memcpy(out, in, c + 1);
+      out += c + 1;
+      in += c + 1;
+    } else if(c > 128) {
+      memset(out, *in++, 257 - c);
+      out += 257 - c;
+    }
+  }
+}
+
+uint16_t to_bf16(float f)
+{
+  uint32_t bits;
+
+  memcpy(&bits, &f, 4);
+  if((bits & 0x7fffffff) > 0x7f800000) return (uint16_t) ((bits >> 16) | 0x40);	/* NaN */
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return (uint16_t) (bits >> 16);
+}
+
+float from_bf16(uint16_t h)
+{
+  uint32_t bits = (uint32_t) h << 16;
+  float f;
+
+  memcpy(&f, &bits, 4);
+  return f;
+}
+
+/*
+ * Code 'n' elements of 'width' bytes ('is_int': 32-bit
+ * integers, else doubles) in 'mode'. 'out' must hold
+ * compress_bound(n, width) bytes and 'tmp' n * width bytes.
+ * Returns the payload bytes
+ */
+size_t compress_payload(
+  const void *v,	/* IN - Elements */
+  size_t n,		/* IN - How many */
+  size_t width,		/* IN - Bytes each */
+  int is_int,		/* IN - Integers or doubles */
+  int mode,		/* IN - COMPRESS_... */
+  unsigned char *out,	/* OUT - Payload */
+  unsigned char *tmp)	/* IN - Work space */
+{
+  const double *d = (const double *) v;
+  size_t i, len;
+
+  if(is_int) {
+    out[0] = CODE_VARINT;
+    len = 1 + varint_encode((const int *) v, n, out + 1);
+  } else if(mode == COMPRESS_FLOAT) {
+    float f;
+    out[0] = CODE_FLOAT;
+    for(i = 0; i < n; i++) {
+      f = (float) d[i];
+      memcpy(out + 1 + 4 * i, &f, 4);
+    }
+    return 1 + 4 * n;
+  } else if(mode == COMPRESS_BF16) {
+    uint16_t h;
+    out[0] = CODE_BF16;
+    for(i = 0; i < n; i++) {
+      h = to_bf16((float) d[i]);
+      memcpy(out + 1 + 2 * i, &h, 2);
+    }
+    return 1 + 2 * n;
+  } else {
+    shuffle_bytes((const unsigned char *) v, n, width, tmp);
+    out[0] = CODE_SHUFFLE_RLE;
+    len = 1 + rle_encode(tmp, n * width, out + 1);
+  }
+  if(len >= 1 + n * width) {
+    out[0] = CODE_RAW;
+    memcpy(out + 1, v, n * width);
+    len = 1 + n * width;
+  }
+  return len;
+}
+
+/*
+ * Decode a payload of 'len' bytes into 'n' elements of
+ * 'width' bytes. 'tmp' must hold n * width bytes
+ */
+void decompress_payload(
+  const unsigned char *in,	/* IN - Payload */
+  size_t len,			/* IN - Its bytes */
+  size_t n,			/* IN - Elements */
+  size_t width,			/* IN - Bytes each */
+  void *v,			/* OUT - Elements */
+  unsigned char *tmp)		/* IN - Work space */
+{
+  double *d = (double *) v;
+  size_t i;
+
+  switch(in[0]) {
+  case CODE_RAW:
+    memcpy(v, in + 1, n * width);
+    break;
+  case CODE_VARINT:
+    varint_decode(in + 1, n, (int *) v);
+    break;
+  case CODE_SHUFFLE_RLE:
+    rle_decode(in + 1, len - 1, tmp);
+    unshuffle_bytes(tmp, n, width, (unsigned char *) v);
+    break;
+  case CODE_FLOAT:
+    for(i = 0; i < n; i++) {
+      float f;
+      memcpy(&f, in + 1 + 4 * i, 4);
+      d[i] = f;
+    }
+    break;
+  case CODE_BF16:
+    for(i = 0; i < n; i++) {
+      uint16_t h;
+      memcpy(&h, in + 1 + 2 * i, 2);
+      d[i] = from_bf16(h);
+    }
+    break;
+  }
+}
+
+#endif
@@ -6,38 +6,180 @@
 
 #include <mpi.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
-#include <ftw.h>
+#include <dirent.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define DICT_SIZE_MSG	0	/* Msg has dictionary size */
 #define FILE_NAME_MSG	1	/* Msg is file name */
 #define VECTOR_MSG	2	/* Msg is profile */ 
 #define EMPTY_MSG	3	/* Msg is empty */
+#define NAMES_MSG	4	/* Msg has names found by a walker */
+#define SUBTREE_MSG	5	/* Msg has directories to walk */
+
+#define CACHE_MAGIC	0x43504344	/* "DCPC" */
+#define CACHE_VERSION	1
 
 #define DIR_ARG		1	/* Directory argument */
 #define DICT_ARG	2	/* Dictionary argument */
 #define RES_ARG		3	/* Results argument */
 
+#define TOKEN_BATCH	32	/* Words hashed per lookup batch */
+#define NAME_BATCH	16384	/* Max bytes of names per message */
+#define MAX_BATCH	64	/* Max documents per assignment */
+#define BATCH_MS	200	/* Default work per assignment (ms) */
+#define PREFETCH	2	/* Assignments queued per worker */
+#define SLOTS		(2 * PREFETCH)	/* Batches queued or being sent */
+
 typedef unsigned char uchar;
 
+/* Element of the chained dictionary hash table. Words are not
+ * copied: 'word' points into the (lowercased) dictionary buffer
+ */
+typedef struct hash_el {
+  char *word;		/* Dictionary word */
+  int len;		/* Chars in word */
+  int index;		/* Position in profile vector */
+  unsigned hash;	/* Full hash of word */
+  struct hash_el *next;	/* Next element in chain */
+} hash_el;
+
+/* What the directory walk learns about a plain file */
+typedef struct {
+  long size;		/* Bytes in file */
+  long long mtime;	/* Modification time (ns) */
+} file_info;
+
+/* Persistent profile cache ('-c file'). An entry is reused
+ * when a document has the same path, size and modification
+ * time (and with '-verify' the same content hash) and the
+ * cache was built with the same dictionary
+ */
+typedef struct {
+  int dict_size;	/* Profile vector size */
+  unsigned long long dict_hash;	/* Hash of dictionary file */
+  int cnt;		/* Entries */
+  char **path;		/* Document path names */
+  file_info *info;	/* Their sizes and times */
+  unsigned long long *content;	/* Their content hashes, 0 if unknown */
+  uchar *profiles;	/* 'cnt' profile vectors */
+  int *table;		/* Entries hashed on path, -1 if empty */
+  int mask;		/* Table size - 1 */
+  int verify;		/* Compare content hashes on a hit */
+  int hits;		/* Entries reused */
+} profile_cache;
+
+/* Documents known to the manager, in the order found, and
+ * the queue of those not assigned yet: in order of discovery,
+ * or a max-heap on size for largest-first ('-lpt').
+ * Documents found in the profile cache are never queued
+ */
+typedef struct {
+  char **name;		/* Path names */
+  long *size;		/* Bytes per document */
+  long long *mtime;	/* Modification times */
+  unsigned long long *content;	/* Content hashes, 0 if unknown */
+  uchar **vector;	/* Profile vectors */
+  profile_cache *cache;	/* Profiles of earlier runs, or NULL */
+  int cnt;		/* Documents found */
+  int max;		/* Capacity of the arrays */
+  int lpt;		/* Set for largest-first order */
+  int *queue;		/* Unassigned documents */
+  int next;		/* Head of 'queue' (FIFO) */
+  int waiting;		/* Documents not assigned yet */
+  double waiting_bytes;	/* Their total size */
+} doc_list;
+
+/* Manager's view of a worker. A worker keeps PREFETCH
+ * requests outstanding, so up to PREFETCH batches are queued
+ * on it and come back in the order they were sent
+ */
+typedef struct {
+  int batch[PREFETCH][MAX_BATCH];	/* Documents assigned */
+  int batch_cnt[PREFETCH];	/* Entries in each batch */
+  int first;		/* Oldest batch not returned */
+  int queued;		/* Batches not returned */
+  int docs;		/* Documents profiled */
+  double bytes;		/* Bytes profiled */
+  double busy;		/* Seconds spent profiling */
+  double rate;		/* Estimated bytes/second */
+  int threads;		/* Threads profiling documents */
+} worker_info;
+
+/* Trailer of every VECTOR_MSG: cost of the batch */
+typedef struct {
+  double bytes;		/* Bytes profiled */
+  double busy;		/* Seconds spent profiling */
+  int threads;		/* Threads that profiled it */
+} batch_stats;
+
+/* A batch queued on a worker. Its documents are taken one
+ * at a time by whichever thread is free
+ */
+typedef struct {
+  char *names;		/* Names of its documents */
+  int offset[MAX_BATCH];	/* Start of each name */
+  int cnt;		/* Documents */
+  int next;		/* First not taken by a thread */
+  int done;		/* Documents profiled */
+  double bytes;		/* Their size */
+  double start;		/* When its first document was taken */
+  double end;		/* When its last was profiled */
+  uchar *profile;	/* Profile vectors, then a batch_stats */
+  MPI_Request sent;	/* Handle for the profile send */
+} worker_batch;
+
+/* State of an incremental, depth-first directory walk */
+typedef struct {
+  char **dirs;		/* Directories not read yet */
+  int dir_cnt;		/* Entries in 'dirs' */
+  int dir_max;		/* Capacity of 'dirs' */
+  DIR *cur;		/* Directory being read */
+  char *cur_path;	/* Path name of 'cur' */
+} dir_walker;
+
 int main(int argc, char * argv[]) {
 
   int id;		/* Process rank */
   int p;		/* Number of processes */
+  int provided;		/* Thread support of MPI library */
   MPI_Comm worker_comm;	/*Workers-only communicator */
   
   void manager(int, char **, int);
   void worker(int, char **, MPI_Comm);
   
-  MPI_Init(&argc, &argv);
+  /* Worker threads never call MPI: all communication is
+   * funneled through the master thread. That is all this
+   * program needs, so it does not ask for
+   * MPI_THREAD_MULTIPLE, which would only make the library
+   * lock around every call. A library that cannot give
+   * FUNNELED gets one thread per worker
+   */
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  if(provided < MPI_THREAD_FUNNELED) {
+#ifdef _OPENMP
+    omp_set_num_threads(1);
+#endif
+    if(!id) printf("MPI library is not thread-safe: one thread per worker\n");
+  }
   
-  if(argc != 4) {
+  if(argc < 4) {
    if(!id) {
     printf("Program needs three arguments \n");
-    printf("%s <dir> <dict> <results>\n", argv[0]);
+    printf("%s <dir> <dict> <results> [-w walkers] [-lpt] [-b batch_ms] [-c cache [-verify]]\n", argv[0]);
    }
   } else if(p < 2) {
     printf("Program needs at least two processes\n");
@@ -56,92 +198,247 @@ int main(int argc, char * argv[]) {
 }
 
 void manager(int argc, char * argv[], int p) {
-  int assign_cnt;	/* Docs assigned so far */ 
-  int *assigned;		/* Document assignments */
-  uchar *buffer;		/* Store profile vectors here */
+  int b;		/* Batch slot of a worker */
+  double batch_time;	/* Seconds of work per assignment */
+  double budget;	/* Bytes for the next assignment */
   int dict_size;		/* Dictionary entries */
-  int file_cnt;		/* Plain text files found */
-  char **file_name;	/* Stores file (path) names */
-  int i;
+  doc_list docs;	/* Documents found so far */
+  double elapsed_time;	/* Time spent dispatching */
+  int flag;		/* Set if a message is waiting */
+  int i, j;
+  int *idle;		/* Workers waiting for a document */
+  int idle_cnt;		/* Entries in 'idle' */
+  int len;		/* Chars in a message */
+  int local_walk;	/* Set while this process walks */
+  char *names;		/* Names found by a walker rank */
+  int names_max;	/* Capacity of 'names' */
+  file_info info;	/* Size and time of a file found */
+  profile_cache cache;	/* Profiles of earlier runs */
+  char *cache_name;	/* Profile cache file, or NULL */
+  char *dict_buf;	/* Dictionary, to version the cache */
+  long dict_len;	/* Chars in dictionary */
+  uchar *buffer;	/* Profiles from a worker */
   MPI_Request pending;	/* Handle for recv request */
+  char *path;		/* File found by this process */
   int src;		/* Message source process */
+  batch_stats stats;	/* Trailer of a profiles message */
   MPI_Status status;	/* Message status */	
   int tag;		/* Message tag */
   int terminated;	/* Count of terminated procs */
-  uchar **vector;	/* Profile vector repository */
+  dir_walker walk;	/* This process's directory walk */
+  int walkers;		/* Ranks walking subtrees */
+  int walking;		/* Walks not finished yet */
+  worker_info *w;	/* State of each worker */
   
-  void build_2d_array(int, int, uchar ***);
-  void get_names(char *, char ***, int *);
+  void add_name(doc_list *, char *, file_info);
+  int next_doc(doc_list *);
+  int option_value(int, char **, char *, int);
+  int option_set(int, char **, char *);
+  char *option_string(int, char **, char *);
+  unsigned long long hash_bytes(const void *, long);
+  void load_cache(char *, unsigned long long, int, profile_cache *);
+  void save_cache(char *, profile_cache *, doc_list *, int);
+  void read_dictionary(char *, char **, long *);
+  void split_tree(char *, int, doc_list *);
+  void walker_push(dir_walker *, const char *);
+  char *next_file(dir_walker *, file_info *);
   void write_profiles(char *, int, int, char **, uchar **);
   
   /* Put in request to receive dictionary size */
   MPI_Irecv(&dict_size, 1, MPI_INT, MPI_ANY_SOURCE, DICT_SIZE_MSG, MPI_COMM_WORLD, &pending);
   
-  /* Collect the names of the documents to be profiled */
-  get_names(argv[DIR_ARG], &file_name, &file_cnt);
-  
-  /* Wait for dictionary size to be received */
-  MPI_Wait(&pending, &status);
-  
-  /* Set aside buffer to catch profiles from workers */
-  buffer = (uchar *)malloc(dict_size * sizeof(MPI_UNSIGNED_CHAR));
+  /* Documents are handed out as soon as they are found.
+   * With '-w k' the top-level subdirectories are shared
+   * among the first k workers, which walk them and send back
+   * the names they find, while this process keeps the files
+   * at the top level
+   */
+  memset(&docs, 0, sizeof(docs));
+  memset(&walk, 0, sizeof(walk));
+  docs.lpt = option_set(argc, argv, "-lpt");
   
-  /* Set aside 2D array to hold all profiles
-   * Call MPI_Abort if the allocation fails
+  /* Documents unchanged since the cached run are never sent
+   * to a worker. The cache is tied to the dictionary by a
+   * hash of the dictionary file
    */
-  build_2d_array(file_cnt, dict_size, &vector);
+  if((cache_name = option_string(argc, argv, "-c")) != NULL) {
+   read_dictionary(argv[DICT_ARG], &dict_buf, &dict_len);
+   load_cache(cache_name, hash_bytes(dict_buf, dict_len), option_set(argc, argv, "-verify"), &cache);
+   free(dict_buf);
+   docs.cache = &cache;
+  }
+  walkers = option_value(argc, argv, "-w", 0);
+  if(walkers > p - 1) walkers = p - 1;
+  if(walkers > 0) split_tree(argv[DIR_ARG], walkers, &docs);
+  else {
+   walkers = 0;
+   walker_push(&walk, argv[DIR_ARG]);
+  }
+  local_walk = !walkers;
+  walking = local_walk + walkers;
+  
+  /* Walk while the workers load the dictionary */
+  for(flag = 0; !flag && local_walk; MPI_Test(&pending, &flag, &status)) {
+    if((path = next_file(&walk, &info)) != NULL) add_name(&docs, path, info);
+    else {
+     local_walk = 0;
+     walking--;
+    }
+  }
+  MPI_Wait(&pending, &status);
   
   /* Respond to requests by workers */
+  batch_time = option_value(argc, argv, "-b", BATCH_MS) / 1000.0;
+  buffer = (uchar *)malloc(MAX_BATCH * dict_size + sizeof(batch_stats));
+  names_max = NAME_BATCH;
+  names = (char *)malloc(names_max);
+  w = (worker_info *)calloc(p, sizeof(worker_info));
+  idle = (int *)malloc(PREFETCH * p * sizeof(int));
   terminated = 0;
-  assign_cnt = 0;
-  assigned = (int *)malloc(p * sizeof(int));
+  idle_cnt = 0;
+  elapsed_time = -MPI_Wtime();
   
   do {
-   /* Get profile from worker */
-   MPI_Recv(buffer, dict_size, MPI_UNSIGNED_CHAR, MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
-   src = status.MPI_SOURCE;
-   tag = status.MPI_TAG;
-   if(tag == VECTOR_MSG) {
-    for(i = 0; i < dict_size; i++)
-      vector[assigned[src]][i] = buffer[i];
-   }
-   /* Assign more work or tell worker to stop */
-   if(assign_cnt < file_cnt) {
-    MPI_Send(file_name[assign_cnt], strlen(file_name[assign_cnt]) + 1, MPI_CHAR, src, FILE_NAME_MSG, MPI_COMM_WORLD);
-    assigned[src] = assign_cnt;
-    assign_cnt++;
+   /* Keep walking until some worker needs attention */
+   flag = 0;
+   if(local_walk) {
+     MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+     if(!flag) {
+       if((path = next_file(&walk, &info)) != NULL) add_name(&docs, path, info);
+       else {
+	 local_walk = 0;
+	 walking--;
+       }
+     }
    } else {
-     MPI_Send(NULL, 0, MPI_CHAR, src, FILE_NAME_MSG, MPI_COMM_WORLD);
-     terminated++;
+     MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+     flag = 1;
+   }
+   
+   if(flag) {
+     src = status.MPI_SOURCE;
+     tag = status.MPI_TAG;
+     if(tag == NAMES_MSG) {
+       /* Files found by a walker; empty when its walk is done */
+       MPI_Get_count(&status, MPI_CHAR, &len);
+       if(len > names_max) names = (char *)realloc(names, names_max = len);
+       MPI_Recv(names, len, MPI_CHAR, src, NAMES_MSG, MPI_COMM_WORLD, &status);
+       if(!len) walking--;
+       for(i = 0; i < len; i += sizeof(file_info) + strlen(names + i + sizeof(file_info)) + 1) {
+	 memcpy(&info, names + i, sizeof(file_info));
+	 add_name(&docs, strdup(names + i + sizeof(file_info)), info);
+       }
+     } else {
+       /* Get profiles from worker, followed by what they cost */
+       MPI_Get_count(&status, MPI_UNSIGNED_CHAR, &len);
+       MPI_Recv(buffer, len, MPI_UNSIGNED_CHAR, src, tag, MPI_COMM_WORLD, &status);
+       if(tag == VECTOR_MSG) {
+	 b = w[src].first;
+	 for(i = 0; i < w[src].batch_cnt[b]; i++) {
+	   docs.vector[w[src].batch[b][i]] = (uchar *)malloc(dict_size);
+	   memcpy(docs.vector[w[src].batch[b][i]], buffer + i * dict_size, dict_size);
+	 }
+	 memcpy(&stats, buffer + w[src].batch_cnt[b] * dict_size, sizeof(stats));
+	 w[src].docs += w[src].batch_cnt[b];
+	 w[src].bytes += stats.bytes;
+	 w[src].busy += stats.busy;
+	 w[src].threads = stats.threads;
+	 if(stats.busy > 0.0)
+	   w[src].rate = w[src].rate > 0.0 ? 0.5 * (w[src].rate + stats.bytes / stats.busy) : stats.bytes / stats.busy;
+	 w[src].first = (b + 1) % PREFETCH;
+	 w[src].queued--;
+       }
+       idle[idle_cnt++] = src;
+     }
+   }
+   
+   /* Assign more work, or tell workers to stop once
+    * every walk has finished. A batch holds about
+    * 'batch_time' seconds of work at the worker's measured
+    * rate, but never more than its share of what is left
+    * once the walks are over, so the run ends evenly. A
+    * threaded worker gets at least a document per thread
+    */
+   while(idle_cnt && (docs.waiting || !walking)) {
+     src = idle[--idle_cnt];
+     if(!docs.waiting) {
+      MPI_Send(NULL, 0, MPI_CHAR, src, FILE_NAME_MSG, MPI_COMM_WORLD);
+      terminated++;
+      continue;
+     }
+     budget = w[src].rate * batch_time;
+     if(!walking && budget > docs.waiting_bytes / (p - 1))
+       budget = docs.waiting_bytes / (p - 1);
+     b = (w[src].first + w[src].queued++) % PREFETCH;
+     w[src].batch_cnt[b] = 0;
+     len = 0;
+     do {
+      j = next_doc(&docs);
+      budget -= docs.size[j];
+      w[src].batch[b][w[src].batch_cnt[b]++] = j;
+      if(len + strlen(docs.name[j]) + 1 > (size_t) names_max)
+	names = (char *)realloc(names, names_max = 2 * (len + strlen(docs.name[j]) + 1));
+      strcpy(names + len, docs.name[j]);
+      len += strlen(docs.name[j]) + 1;
+     } while(docs.waiting && (budget > 0 || w[src].batch_cnt[b] < w[src].threads) && w[src].batch_cnt[b] < MAX_BATCH);
+     MPI_Send(names, len, MPI_CHAR, src, FILE_NAME_MSG, MPI_COMM_WORLD);
    }
-  } while(terminated < (p - 1));
+  } while(terminated < PREFETCH * (p - 1));
+  elapsed_time += MPI_Wtime();
+  
+  printf("  Rank Threads    Docs        MB    Busy (s)    Idle (s)      MB/s\n");
+  for(i = 1; i < p; i++)
+    printf("%6d %7d %7d %9.1f %11.3f %11.3f %9.1f\n", i, w[i].threads, w[i].docs, w[i].bytes / 1e6, w[i].busy, elapsed_time - w[i].busy, w[i].busy > 0.0 ? w[i].bytes / w[i].busy / 1e6 : 0.0);
   
-  write_profiles(argv[RES_ARG], file_cnt, dict_size, file_name, vector);
+  if(cache_name != NULL) {
+   printf("Profile cache: %d of %d documents unchanged\n", cache.hits, docs.cnt);
+   save_cache(cache_name, &cache, &docs, dict_size);
+  }
+  fflush(stdout);
+  
+  write_profiles(argv[RES_ARG], docs.cnt, dict_size, docs.name, docs.vector);
 }
 
 void worker(int argc, char * argv[], MPI_Comm worker_comm)
 {
+  worker_batch batch[SLOTS];	/* Batches received, in order */
   char *buffer;		/* Words in dictionary */
   hash_el **dict;	/* Hash table of words */	
   int dict_size;	/* Profile vector size */
   long file_len;	/* Chars in dictionary */
+  int head;		/* Oldest batch not sent back */
   int i;
-  char *name;		/* Name of plain text files */
-  int name_len;		/* Chars in file name */
-  MPI_Request pending;	/* Handle for MPI_Send */
-  uchar *profile;	/* Document profile vector */
+  double idle_time;	/* Seconds spent waiting for work */
+  double last_end;	/* When the last batch sent was done */
+  int name_len;		/* Chars in file names */
+  MPI_Request pending[PREFETCH];	/* Handles for work requests */
+  int p;		/* Number of processes */
+  double profile_time;	/* Seconds spent profiling */
+  int requests;		/* Requests not answered yet */
+  batch_stats stats;	/* Cost of a batch */
   MPI_Status status;	/* Info about message */
+  int stop;		/* Every request answered and batch sent */
+  int tail;		/* Next batch to receive */
+  long tokens;		/* Words scanned by this worker */
   int worker_id;	/* Rank in worker_comm */
   
-  void build_hash_table(char *, int, hash_el ***, int *);
-  void make_profile(char *, hash_el **, int, uchar *);
+  void build_hash_table(char *, long, hash_el ***, int *);
+  long make_profile(char *, hash_el **, int, uchar *, long *);
+  double wall_time(void);
   void read_dictionary(char *, char **, long *);
+  int option_value(int, char **, char *, int);
+  void walk_subtrees(void);
   
   /* Worker gets its worker ID number */
   MPI_Comm_rank(worker_comm, &worker_id);
   
-  /* Worker makes intiial request for work */
-  MPI_Isend(NULL, 0, MPI_UNSIGNED_CHAR, 0, EMPTY_MSG, MPI_COMM_WORLD, &pending);
+  /* Worker makes intiial requests for work. It keeps
+   * PREFETCH of them outstanding, so the next batch is
+   * already queued when the current one is finished
+   */
+  for(i = 0; i < PREFETCH; i++)
+    MPI_Isend(NULL, 0, MPI_UNSIGNED_CHAR, 0, EMPTY_MSG, MPI_COMM_WORLD, &pending[i]);
+  requests = PREFETCH;
   
   /* Read and broadcast dictionary file */
   if(!worker_id)
@@ -150,31 +447,922 @@ void worker(int argc, char * argv[], MPI_Comm worker_comm)
   if(worker_id) buffer = (char *)malloc(file_len);
   MPI_Bcast(buffer, file_len, MPI_CHAR, 0, worker_comm);
   
-  /* Build hash table */
+  /* Build hash table, shared by all threads */
   build_hash_table(buffer, file_len, &dict, &dict_size);
   
-  profile = (uchar *)malloc(dict_size * sizeof(uchar));
+  for(i = 0; i < SLOTS; i++) {
+    batch[i].profile = (uchar *)malloc(MAX_BATCH * dict_size + sizeof(batch_stats));
+    batch[i].sent = MPI_REQUEST_NULL;
+  }
   
   /* Worker 0 sends msg to manager res size of dictionary */
   if(!worker_id) MPI_Send(&dict_size, 1, MPI_INT, 0, DICT_SIZE_MSG, MPI_COMM_WORLD);
   
-  for(;;) {
-   /*Find out length of file name */ 
-   
-   MPI_Probe(0, FILE_NAME_MSG, MPI_COMM_WORLD, &status);
-   MPI_Get_count(&status, MPI_CHAR, &name_len);
-   
-   /* Drop out if no more work */
-   if(!name_len) break;
-   
-   name = (char *)malloc(name_len);
-   MPI_Recv(name, name_len, MPI_CHAR, 0, FILE_NAME_MSG, MPI_COMM_WORLD, &status);
-   
-   make_profile(name, dict, dict_size, profile);
-   free(name);
+  /* The first '-w' workers walk part of the directory tree */
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  if(worker_id < option_value(argc, argv, "-w", 0) && worker_id < p - 1)
+    walk_subtrees();
+  
+  tokens = 0;
+  profile_time = 0.0;
+  idle_time = 0.0;
+  stats.threads = 1;
+#ifdef _OPENMP
+  stats.threads = omp_get_max_threads();
+#endif
+  head = tail = 0;
+  stop = 0;
+  last_end = wall_time();
+  
+  /* One pool of threads for the whole run. Each thread
+   * takes the next document of the oldest batch that has
+   * one left; the master thread also receives batches into
+   * the queue and sends finished ones back, in order, so
+   * the next batch is queued before the threads run out.
+   * All queue fields are read and written in the critical
+   * section
+   */
+#pragma omp parallel private(i)
+  {
+   int master = 1;	/* Thread doing the communication */
+   int b, j;		/* Document taken: batch, index */
+   int msg;		/* A batch or answer is waiting */
+   long bytes;		/* Size of a document */
+   long words;		/* Words in it */
    
-   MPI_Send(profile, dict_size, MPI_UNSIGNED_CHAR, 0, VECTOR_MSG, MPI_COMM_WORLD);
+#ifdef _OPENMP
+   master = !omp_get_thread_num();
+#endif
+   for(;;) {
+    if(master) {
+     /* Send back finished batches. The profiles double
+      * as the next request for work
+      */
+     for(;;) {
+#pragma omp critical(worker_queue)
+      b = head != tail && batch[head].done == batch[head].cnt ? head : -1;
+      if(b < 0) break;
+      stats.busy = batch[b].end - (batch[b].start > last_end ? batch[b].start : last_end);
+      stats.bytes = batch[b].bytes;
+      last_end = batch[b].end;
+      profile_time += stats.busy;
+      memcpy(batch[b].profile + batch[b].cnt * dict_size, &stats, sizeof(stats));
+      MPI_Isend(batch[b].profile, batch[b].cnt * dict_size + sizeof(stats), MPI_UNSIGNED_CHAR, 0,
+		VECTOR_MSG, MPI_COMM_WORLD, &batch[b].sent);
+      free(batch[b].names);
+      requests++;
+#pragma omp critical(worker_queue)
+      head = (head + 1) % SLOTS;
+     }
+     
+     /* Take in the answer to a request: a batch, or an empty
+      * message meaning no more work. With nothing queued
+      * there is nothing else to do, so wait for it
+      */
+     msg = 0;
+     if(requests) {
+#pragma omp critical(worker_queue)
+      b = head == tail;
+      if(b) {
+       idle_time -= MPI_Wtime();
+       MPI_Probe(0, FILE_NAME_MSG, MPI_COMM_WORLD, &status);
+       idle_time += MPI_Wtime();
+       msg = 1;
+      } else MPI_Iprobe(0, FILE_NAME_MSG, MPI_COMM_WORLD, &msg, &status);
+     }
+     if(msg) {
+      MPI_Get_count(&status, MPI_CHAR, &name_len);
+      requests--;
+      b = tail;
+      MPI_Wait(&batch[b].sent, MPI_STATUS_IGNORE);
+      batch[b].names = (char *)malloc(name_len + 1);
+      MPI_Recv(batch[b].names, name_len, MPI_CHAR, 0, FILE_NAME_MSG, MPI_COMM_WORLD, &status);
+      if(!name_len) free(batch[b].names);
+      else {
+       for(i = j = 0; i < name_len; i += strlen(batch[b].names + i) + 1)
+	 batch[b].offset[j++] = i;
+       batch[b].cnt = j;
+       batch[b].next = batch[b].done = 0;
+       batch[b].bytes = 0.0;
+#pragma omp critical(worker_queue)
+       tail = (tail + 1) % SLOTS;
+      }
+      continue;
+     }
+     if(!requests) {
+#pragma omp critical(worker_queue)
+      stop = head == tail;
+      if(stop) break;
+     }
+    }
+    
+    /* Take a document */
+    j = -1;
+#pragma omp critical(worker_queue)
+    {
+     for(b = head; b != tail && batch[b].next == batch[b].cnt; b = (b + 1) % SLOTS);
+     if(b != tail) {
+      if(!batch[b].next) batch[b].start = wall_time();
+      j = batch[b].next++;
+     } else if(stop) b = -1;
+    }
+    if(b < 0) break;
+    if(j < 0) {
+     if(!master) sched_yield();
+     continue;
+    }
+    words = make_profile(batch[b].names + batch[b].offset[j], dict, dict_size, batch[b].profile + j * dict_size, &bytes);
+#pragma omp critical(worker_queue)
+    {
+     tokens += words;
+     batch[b].bytes += bytes;
+     if(++batch[b].done == batch[b].cnt) batch[b].end = wall_time();
+    }
+   }
+  }
+  for(i = 0; i < SLOTS; i++) MPI_Wait(&batch[i].sent, MPI_STATUS_IGNORE);
+  MPI_Waitall(PREFETCH, pending, MPI_STATUSES_IGNORE);
+  
+  printf("Worker %d: %ld tokens in %.3f s (%.0f tokens/s) on %d threads, idle %.3f s\n", worker_id, tokens, profile_time, profile_time > 0.0 ? tokens / profile_time : 0.0, stats.threads, idle_time);
+  fflush(stdout);
+}
+
+
+/*
+ * Seconds from a fixed point, callable from any thread
+ */
+double wall_time(void)
+{
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return MPI_Wtime();
+#endif
+}
+
+
+/*
+ * Process the whole dictionary file into memory,
+ * returning a buffer and its length
+ */
+void read_dictionary(char *name, char **buffer, long *file_len)
+{
+  FILE *dictfile;	/* Dictionary file pointer */
+  
+  dictfile = fopen(name, "r");
+  if(dictfile == NULL) {
+   printf("Cannot open dictionary '%s'\n", name);
+   fflush(stdout);
+   MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+  fseek(dictfile, 0, SEEK_END);
+  *file_len = ftell(dictfile);
+  rewind(dictfile);
+  *buffer = (char *)malloc(*file_len);
+  if(*buffer == NULL || fread(*buffer, 1, *file_len, dictfile) != (size_t) *file_len) {
+   printf("Cannot read dictionary '%s'\n", name);
+   fflush(stdout);
+   MPI_Abort(MPI_COMM_WORLD, 1);
   }
+  fclose(dictfile);
 }
 
+/*
+ * Hash table size used for a dictionary of 'dict_size'
+ * words: the smallest power of two at least twice as
+ * large, so a bucket is found with a mask
+ */
+int hash_table_size(int dict_size)
+{
+  int size;
+  
+  for(size = 16; size < 2 * dict_size; size <<= 1);
+  return size;
+}
+
+/*
+ * FNV-1a hash of a word. Only letters reach this function,
+ * so OR-ing in 0x20 folds upper case onto lower case
+ */
+unsigned hash_word(const uchar *word, int len)
+{
+  unsigned h = 2166136261u;
+  int i;
+  
+  for(i = 0; i < len; i++) {
+   h ^= word[i] | 0x20;
+   h *= 16777619u;
+  }
+  return h;
+}
+
+/*
+ * Classify 64 bytes at once: bit 'i' of the result is set
+ * when 'p[i]' is an ASCII letter, i.e. part of a word
+ */
+unsigned long long word_mask(const uchar *p)
+{
+  unsigned long long bits = 0;
+  int k;
+#ifdef __SSE2__
+  const __m128i below = _mm_set1_epi8('a' - 1);
+  const __m128i above = _mm_set1_epi8('z' + 1);
+  const __m128i fold = _mm_set1_epi8(0x20);
+  __m128i v;
+  
+  for(k = 0; k < 4; k++) {
+   v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + 16 * k)), fold);
+   v = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+   bits |= (unsigned long long)(unsigned)_mm_movemask_epi8(v) << (16 * k);
+  }
+#else
+  uchar c;
+  
+  for(k = 0; k < 64; k++) {
+   c = p[k] | 0x20;
+   if(c >= 'a' && c <= 'z') bits |= 1ULL << k;
+  }
+#endif
+  return bits;
+}
+
+/*
+ * Split the dictionary buffer into words, lowercase them in
+ * place and insert each distinct word into a chained hash
+ * table. Table elements point into 'buffer', which must
+ * outlive the table
+ */
+void build_hash_table(char *buffer, long len, hash_el ***dict, int *dict_size)
+{
+  hash_el *el;		/* Storage for all table elements */
+  hash_el *e;
+  unsigned h;
+  long i, start;
+  int mask;		/* Table size - 1 */
+  int words;		/* Upper bound on distinct words */
+  
+  for(i = 0; i < len; i++)
+    if(buffer[i] >= 'A' && buffer[i] <= 'Z') buffer[i] |= 0x20;
+  
+  words = 0;
+  for(i = 0; i < len; i++)
+    if(buffer[i] >= 'a' && buffer[i] <= 'z' && (!i || buffer[i - 1] < 'a' || buffer[i - 1] > 'z'))
+      words++;
+  
+  el = (hash_el *)malloc((words ? words : 1) * sizeof(hash_el));
+  mask = hash_table_size(words) - 1;
+  *dict = (hash_el **)calloc(mask + 1, sizeof(hash_el *));
+  if(el == NULL || *dict == NULL) MPI_Abort(MPI_COMM_WORLD, 1);
+  
+  *dict_size = 0;
+  for(i = 0; i < len; ) {
+   while(i < len && (buffer[i] < 'a' || buffer[i] > 'z')) i++;
+   if(i == len) break;
+   start = i;
+   while(i < len && buffer[i] >= 'a' && buffer[i] <= 'z') i++;
+   h = hash_word((uchar *) buffer + start, i - start);
+   for(e = (*dict)[h & mask]; e != NULL; e = e->next)
+     if(e->hash == h && e->len == i - start && !memcmp(e->word, buffer + start, e->len)) break;
+   if(e != NULL) continue;
+   e = &el[*dict_size];
+   e->word = buffer + start;
+   e->len = i - start;
+   e->index = (*dict_size)++;
+   e->hash = h;
+   e->next = (*dict)[h & mask];
+   (*dict)[h & mask] = e;
+  }
+  
+  /* Duplicates shrank the dictionary: rehash into the table
+   * size 'make_profile' derives from 'dict_size'
+   */
+  if(hash_table_size(*dict_size) - 1 != mask) {
+   free(*dict);
+   mask = hash_table_size(*dict_size) - 1;
+   *dict = (hash_el **)calloc(mask + 1, sizeof(hash_el *));
+   for(i = 0; i < *dict_size; i++) {
+     el[i].next = (*dict)[el[i].hash & mask];
+     (*dict)[el[i].hash & mask] = &el[i];
+   }
+  }
+}
 
+/*
+ * Count 'n' words in the profile vector. The chain heads are
+ * fetched for the whole batch before any element is compared,
+ * so the cache misses of the lookups overlap
+ */
+void lookup_batch(
+  hash_el **dict,	/* IN - Hash table */
+  int mask,		/* IN - Table size - 1 */
+  const uchar **word,	/* IN - Words (not terminated) */
+  int *len,		/* IN - Word lengths */
+  unsigned *hash,	/* IN - Word hashes */
+  int n,		/* IN - Words in batch */
+  uchar *profile)	/* IN/OUT - Profile vector */
+{
+  hash_el *chain[TOKEN_BATCH];	/* Bucket heads */
+  hash_el *e;
+  int i, j;
+  
+  for(i = 0; i < n; i++) {
+   chain[i] = dict[hash[i] & mask];
+   if(chain[i] != NULL) __builtin_prefetch(chain[i]);
+  }
+  for(i = 0; i < n; i++) {
+   for(e = chain[i]; e != NULL; e = e->next) {
+     if(e->hash != hash[i] || e->len != len[i]) continue;
+     for(j = 0; j < len[i] && (word[i][j] | 0x20) == (uchar) e->word[j]; j++);
+     if(j == len[i]) {
+       if(profile[e->index] < 255) profile[e->index]++;
+       break;
+     }
+   }
+  }
+}
+
+/*
+ * Build the profile vector of document 'name': the number of
+ * occurrences (saturated at 255) of every dictionary word.
+ * The document is mapped rather than read, word boundaries
+ * are found 64 bytes at a time by 'word_mask', and words are
+ * looked up in batches of TOKEN_BATCH with the buckets
+ * prefetched, so no word is ever copied. Returns the number
+ * of words scanned and sets 'bytes' to the document size
+ */
+long make_profile(char *name, hash_el **dict, int dict_size, uchar *profile, long *bytes)
+{
+  unsigned long long bits;	/* Letter mask of current block */
+  uchar *doc;		/* Mapped document */
+  int fd;		/* Document file descriptor */
+  unsigned hash[TOKEN_BATCH];	/* Hashes of batched words */
+  int in_word;		/* Block boundary splits a word */
+  int len[TOKEN_BATCH];	/* Lengths of batched words */
+  int mask;		/* Hash table size - 1 */
+  int n;		/* Words in batch */
+  long pos, base, end;
+  long size;		/* Bytes in document */
+  struct stat st;	/* Document status */
+  uchar tail[64];	/* Zero-padded last partial block */
+  long tokens;		/* Words scanned */
+  const uchar *word[TOKEN_BATCH];	/* Batched words */
+  long word_start;	/* Offset of current word */
+  
+  void lookup_batch(hash_el **, int, const uchar **, int *, unsigned *, int, uchar *);
+  
+  memset(profile, 0, dict_size);
+  *bytes = 0;
+  fd = open(name, O_RDONLY);
+  if(fd < 0) return 0;
+  if(fstat(fd, &st) || st.st_size == 0) {
+   close(fd);
+   return 0;
+  }
+  *bytes = size = st.st_size;
+  doc = (uchar *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(doc == MAP_FAILED) return 0;
+  madvise(doc, size, MADV_SEQUENTIAL);
+  
+  mask = hash_table_size(dict_size) - 1;
+  tokens = 0;
+  n = 0;
+  in_word = 0;
+  word_start = 0;
+  for(base = 0; base < size || in_word; base += 64) {
+    if(base >= size) bits = 0;
+    else if(size - base >= 64) bits = word_mask(doc + base);
+    else {
+     memset(tail, 0, sizeof(tail));
+     memcpy(tail, doc + base, size - base);
+     bits = word_mask(tail);
+    }
+    
+    /* Walk the runs of set bits; a run reaching bit 63
+     * continues into the next block
+     */
+    pos = 0;
+    while(pos < 64) {
+      if(!in_word) {
+	if(!(bits >> pos)) break;
+	pos += __builtin_ctzll(bits >> pos);
+	word_start = base + pos;
+	in_word = 1;
+      }
+      if(!(~bits >> pos)) break;
+      end = pos + __builtin_ctzll(~bits >> pos);
+      in_word = 0;
+      pos = end;
+      
+      word[n] = doc + word_start;
+      len[n] = base + end - word_start;
+      hash[n] = hash_word(word[n], len[n]);
+      __builtin_prefetch(&dict[hash[n] & mask]);
+      tokens++;
+      
+      if(++n == TOKEN_BATCH) {
+	lookup_batch(dict, mask, word, len, hash, n, profile);
+	n = 0;
+      }
+    }
+  }
+  lookup_batch(dict, mask, word, len, hash, n, profile);
+  munmap(doc, size);
+  return tokens;
+}
+
+/*
+ * Return the integer following option 'flag' among the
+ * optional arguments, or 'def' if the option is absent
+ */
+int option_value(int argc, char *argv[], char *flag, int def)
+{
+  int i;
+  
+  for(i = RES_ARG + 1; i < argc - 1; i++)
+    if(!strcmp(argv[i], flag)) return atoi(argv[i + 1]);
+  return def;
+}
+
+/*
+ * Return the argument following option 'flag', or NULL if
+ * the option is absent
+ */
+char *option_string(int argc, char *argv[], char *flag)
+{
+  int i;
+  
+  for(i = RES_ARG + 1; i < argc - 1; i++)
+    if(!strcmp(argv[i], flag)) return argv[i + 1];
+  return NULL;
+}
+
+/*
+ * Return 1 if option 'flag' is among the optional arguments
+ */
+int option_set(int argc, char *argv[], char *flag)
+{
+  int i;
+  
+  for(i = RES_ARG + 1; i < argc; i++)
+    if(!strcmp(argv[i], flag)) return 1;
+  return 0;
+}
+
+/*
+ * Append a document (taking ownership of 'name'). Its profile
+ * is taken from the cache if it is unchanged, otherwise the
+ * document is queued for assignment
+ */
+void add_name(doc_list *docs, char *name, file_info info)
+{
+  int child, parent;	/* Heap positions */
+  int i;
+  long size;		/* Bytes in document */
+  
+  uchar *cache_lookup(profile_cache *, char *, file_info, unsigned long long *);
+  
+  if(docs->cnt == docs->max) {
+   docs->max = docs->max ? 2 * docs->max : 1024;
+   docs->name = (char **)realloc(docs->name, docs->max * sizeof(char *));
+   docs->size = (long *)realloc(docs->size, docs->max * sizeof(long));
+   docs->mtime = (long long *)realloc(docs->mtime, docs->max * sizeof(long long));
+   docs->content = (unsigned long long *)realloc(docs->content, docs->max * sizeof(unsigned long long));
+   docs->vector = (uchar **)realloc(docs->vector, docs->max * sizeof(uchar *));
+   docs->queue = (int *)realloc(docs->queue, docs->max * sizeof(int));
+   if(docs->name == NULL || docs->size == NULL || docs->mtime == NULL || docs->content == NULL
+      || docs->vector == NULL || docs->queue == NULL) {
+     printf("Cannot allocate document list\n");
+     fflush(stdout);
+     MPI_Abort(MPI_COMM_WORLD, 1);
+   }
+  }
+  i = docs->cnt++;
+  size = info.size;
+  docs->name[i] = name;
+  docs->size[i] = size;
+  docs->mtime[i] = info.mtime;
+  docs->content[i] = 0;
+  docs->vector[i] = NULL;
+  if(docs->cache != NULL
+     && (docs->vector[i] = cache_lookup(docs->cache, name, info, &docs->content[i])) != NULL)
+    return;
+  docs->waiting_bytes += size;
+  
+  /* Append to the FIFO, or sift the new document up the
+   * max-heap on size
+   */
+  if(!docs->lpt) docs->queue[docs->next + docs->waiting] = i;
+  else {
+   for(child = docs->waiting; child > 0; child = parent) {
+     parent = (child - 1) / 2;
+     if(docs->size[docs->queue[parent]] >= size) break;
+     docs->queue[child] = docs->queue[parent];
+   }
+   docs->queue[child] = i;
+  }
+  docs->waiting++;
+}
+
+/*
+ * Remove and return the next document to assign: the oldest
+ * one, or with '-lpt' the largest one found so far
+ */
+int next_doc(doc_list *docs)
+{
+  int child, parent;	/* Heap positions */
+  int i;		/* Document returned */
+  int last;		/* Document moved from end of heap */
+  
+  docs->waiting--;
+  if(!docs->lpt) i = docs->queue[docs->next++];
+  else {
+   i = docs->queue[0];
+   last = docs->queue[docs->waiting];
+   for(parent = 0; (child = 2 * parent + 1) < docs->waiting; parent = child) {
+     if(child + 1 < docs->waiting && docs->size[docs->queue[child + 1]] > docs->size[docs->queue[child]])
+       child++;
+     if(docs->size[docs->queue[child]] <= docs->size[last]) break;
+     docs->queue[parent] = docs->queue[child];
+   }
+   docs->queue[parent] = last;
+  }
+  docs->waiting_bytes -= docs->size[i];
+  return i;
+}
+
+/*
+ * Schedule directory 'path' to be read by walk 'w'
+ */
+void walker_push(dir_walker *w, const char *path)
+{
+  if(w->dir_cnt == w->dir_max) {
+   w->dir_max = w->dir_max ? 2 * w->dir_max : 64;
+   w->dirs = (char **)realloc(w->dirs, w->dir_max * sizeof(char *));
+  }
+  w->dirs[w->dir_cnt++] = strdup(path);
+}
+
+/*
+ * Build the path name of entry 'd' of directory 'dir' and
+ * tell whether it is a directory or a plain file, falling
+ * back to 'lstat' when the file system does not fill in
+ * 'd_type'. Symbolic links are neither. Plain files are
+ * 'lstat'ed for their size, which drives scheduling, and
+ * modification time, which validates cached profiles
+ */
+char *entry_path(const char *dir, struct dirent *d, int *is_dir, int *is_reg, file_info *info)
+{
+  char *path;		/* Path name of entry */
+  struct stat st;	/* Status of entry */
+  
+  path = (char *)malloc(strlen(dir) + strlen(d->d_name) + 2);
+  sprintf(path, "%s/%s", dir, d->d_name);
+  *is_dir = (d->d_type == DT_DIR);
+  *is_reg = (d->d_type == DT_REG);
+  info->size = 0;
+  info->mtime = 0;
+  if((d->d_type == DT_UNKNOWN || *is_reg) && !lstat(path, &st)) {
+   *is_dir = S_ISDIR(st.st_mode);
+   *is_reg = S_ISREG(st.st_mode);
+   info->size = st.st_size;
+   info->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+  }
+  return path;
+}
+
+/*
+ * Advance walk 'w' to the next plain file and return its
+ * path name (to be freed by the caller), size and time, or
+ * NULL when the walk is over. Only one directory is open at a
+ * time, so a walk can be interleaved with other work file
+ * by file
+ */
+char *next_file(dir_walker *w, file_info *info)
+{
+  struct dirent *d;	/* Directory entry */
+  int is_dir, is_reg;	/* Type of entry */
+  char *path;		/* Path name of entry */
+  
+  char *entry_path(const char *, struct dirent *, int *, int *, file_info *);
+  
+  for(;;) {
+    if(w->cur == NULL) {
+      if(!w->dir_cnt) return NULL;
+      w->cur_path = w->dirs[--w->dir_cnt];
+      if((w->cur = opendir(w->cur_path)) == NULL) {
+	free(w->cur_path);
+	continue;
+      }
+    }
+    if((d = readdir(w->cur)) == NULL) {
+      closedir(w->cur);
+      w->cur = NULL;
+      free(w->cur_path);
+      continue;
+    }
+    if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+    
+    path = entry_path(w->cur_path, d, &is_dir, &is_reg, info);
+    if(is_reg) return path;
+    if(is_dir) walker_push(w, path);
+    free(path);
+  }
+}
+
+/*
+ * Manager: read the top level of 'dir', keeping its files and
+ * dealing its subdirectories round-robin to the first
+ * 'walkers' workers in SUBTREE_MSG messages of NUL-separated
+ * path names
+ */
+void split_tree(char *dir, int walkers, doc_list *docs)
+{
+  struct dirent *d;	/* Directory entry */
+  DIR *dp;		/* Top-level directory */
+  int i;
+  int is_dir, is_reg;	/* Type of entry */
+  int *len;		/* Chars of names per walker */
+  char **list;		/* Subdirectories per walker */
+  char *name;		/* Path name of entry */
+  int next;		/* Walker getting next subdirectory */
+  file_info info;	/* Size and time of plain file */
+  
+  char *entry_path(const char *, struct dirent *, int *, int *, file_info *);
+  
+  list = (char **)calloc(walkers, sizeof(char *));
+  len = (int *)calloc(walkers, sizeof(int));
+  next = 0;
+  
+  if((dp = opendir(dir)) != NULL) {
+    while((d = readdir(dp)) != NULL) {
+      if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+      name = entry_path(dir, d, &is_dir, &is_reg, &info);
+      if(is_reg) {
+	add_name(docs, name, info);
+	continue;
+      }
+      if(is_dir) {
+	list[next] = (char *)realloc(list[next], len[next] + strlen(name) + 1);
+	strcpy(list[next] + len[next], name);
+	len[next] += strlen(name) + 1;
+	next = (next + 1) % walkers;
+      }
+      free(name);
+    }
+    closedir(dp);
+  }
+  
+  for(i = 0; i < walkers; i++) {
+    MPI_Send(list[i], len[i], MPI_CHAR, i + 1, SUBTREE_MSG, MPI_COMM_WORLD);
+    free(list[i]);
+  }
+  free(list);
+  free(len);
+}
+
+/*
+ * Worker: walk the subdirectories the manager assigned and
+ * send the files found in NAMES_MSG batches, each file as
+ * its 'file_info' followed by its NUL-terminated name, then
+ * an empty message
+ */
+void walk_subtrees(void)
+{
+  char batch[NAME_BATCH];	/* Names not sent yet */
+  int i;
+  int len;		/* Chars in 'batch' */
+  int list_len;		/* Chars in subtree list */
+  char *list;		/* Subdirectories to walk */
+  char *name;		/* File found */
+  int need;		/* Chars to pack 'name' */
+  file_info info;	/* Size and time of 'name' */
+  MPI_Status status;	/* Info about message */
+  dir_walker walk;	/* Walk of the subtrees */
+  
+  MPI_Probe(0, SUBTREE_MSG, MPI_COMM_WORLD, &status);
+  MPI_Get_count(&status, MPI_CHAR, &list_len);
+  list = (char *)malloc(list_len + 1);
+  MPI_Recv(list, list_len, MPI_CHAR, 0, SUBTREE_MSG, MPI_COMM_WORLD, &status);
+  
+  memset(&walk, 0, sizeof(walk));
+  for(i = 0; i < list_len; i += strlen(list + i) + 1)
+    walker_push(&walk, list + i);
+  free(list);
+  
+  len = 0;
+  while((name = next_file(&walk, &info)) != NULL) {
+    need = sizeof(file_info) + strlen(name) + 1;
+    if(len + need > NAME_BATCH && len) {
+      MPI_Send(batch, len, MPI_CHAR, 0, NAMES_MSG, MPI_COMM_WORLD);
+      len = 0;
+    }
+    if(need <= NAME_BATCH) {
+      memcpy(batch + len, &info, sizeof(file_info));
+      strcpy(batch + len + sizeof(file_info), name);
+      len += need;
+    }
+    free(name);
+  }
+  if(len) MPI_Send(batch, len, MPI_CHAR, 0, NAMES_MSG, MPI_COMM_WORLD);
+  MPI_Send(NULL, 0, MPI_CHAR, 0, NAMES_MSG, MPI_COMM_WORLD);
+}
+
+/*
+ * Write the profile vectors: a header with the document and
+ * dictionary counts, then for each document the length of
+ * its name, the name and its profile vector
+ */
+void write_profiles(char *name, int file_cnt, int dict_size, char **file_name, uchar **vector)
+{
+  FILE *outfile;	/* Results file */
+  int i;
+  int len;		/* Chars in document name */
+  
+  outfile = fopen(name, "w");
+  if(outfile == NULL) {
+   printf("Cannot open results file '%s'\n", name);
+   fflush(stdout);
+   return;
+  }
+  fwrite(&file_cnt, sizeof(int), 1, outfile);
+  fwrite(&dict_size, sizeof(int), 1, outfile);
+  for(i = 0; i < file_cnt; i++) {
+   len = strlen(file_name[i]);
+   fwrite(&len, sizeof(int), 1, outfile);
+   fwrite(file_name[i], 1, len, outfile);
+   fwrite(vector[i], 1, dict_size, outfile);
+  }
+  fclose(outfile);
+}
+
+/*
+ * 64-bit FNV-1a hash of 'len' bytes
+ */
+unsigned long long hash_bytes(const void *p, long len)
+{
+  const uchar *b = (const uchar *)p;
+  unsigned long long h = 14695981039346656037ULL;
+  long i;
+  
+  for(i = 0; i < len; i++) {
+   h ^= b[i];
+   h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+/*
+ * Hash of the contents of file 'name', never 0 for a
+ * readable file (0 means unknown)
+ */
+unsigned long long hash_file(char *name)
+{
+  uchar *doc;		/* Mapped file */
+  int fd;		/* File descriptor */
+  unsigned long long h;
+  struct stat st;	/* File status */
+  
+  if((fd = open(name, O_RDONLY)) < 0) return 0;
+  if(fstat(fd, &st) || !st.st_size) {
+   close(fd);
+   return 1;
+  }
+  doc = (uchar *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(doc == MAP_FAILED) return 0;
+  h = hash_bytes(doc, st.st_size);
+  munmap(doc, st.st_size);
+  return h ? h : 1;
+}
+
+/*
+ * Read profile cache 'name'. The cache starts out empty if
+ * the file does not exist or was built with a dictionary
+ * whose hash differs from 'dict_hash'. File layout: magic,
+ * version, dictionary size and hash, entry count, then per
+ * entry the path length, path, 'file_info', content hash and
+ * profile vector
+ */
+void load_cache(char *name, unsigned long long dict_hash, int verify, profile_cache *c)
+{
+  FILE *cachefile;	/* Cache file pointer */
+  int head[2];		/* Magic and version */
+  int i, j;
+  int len;		/* Chars in path */
+  int ok;		/* Set while reads succeed */
+  
+  memset(c, 0, sizeof(*c));
+  c->dict_hash = dict_hash;
+  c->verify = verify;
+  
+  if((cachefile = fopen(name, "r")) != NULL) {
+   ok = fread(head, sizeof(int), 2, cachefile) == 2
+	&& head[0] == CACHE_MAGIC && head[1] == CACHE_VERSION
+	&& fread(&c->dict_size, sizeof(int), 1, cachefile) == 1
+	&& fread(&c->dict_hash, sizeof(c->dict_hash), 1, cachefile) == 1
+	&& fread(&c->cnt, sizeof(int), 1, cachefile) == 1;
+   if(ok && c->dict_hash != dict_hash) {
+     printf("Profile cache '%s' was built with another dictionary; ignored\n", name);
+     ok = 0;
+   }
+   if(ok) {
+     c->path = (char **)malloc((c->cnt + 1) * sizeof(char *));
+     c->info = (file_info *)malloc((c->cnt + 1) * sizeof(file_info));
+     c->content = (unsigned long long *)malloc((c->cnt + 1) * sizeof(unsigned long long));
+     c->profiles = (uchar *)malloc((size_t)(c->cnt + 1) * c->dict_size);
+     if(c->path == NULL || c->info == NULL || c->content == NULL || c->profiles == NULL) ok = 0;
+   }
+   for(i = 0; ok && i < c->cnt; i++) {
+     ok = fread(&len, sizeof(int), 1, cachefile) == 1 && len >= 0
+	  && (c->path[i] = (char *)malloc(len + 1)) != NULL
+	  && fread(c->path[i], 1, len, cachefile) == (size_t) len
+	  && fread(&c->info[i], sizeof(file_info), 1, cachefile) == 1
+	  && fread(&c->content[i], sizeof(unsigned long long), 1, cachefile) == 1
+	  && fread(c->profiles + (size_t) i * c->dict_size, 1, c->dict_size, cachefile) == (size_t) c->dict_size;
+     if(ok) c->path[i][len] = '\0';
+   }
+   if(!ok) {
+     c->cnt = 0;
+     c->dict_hash = dict_hash;
+   }
+   fclose(cachefile);
+  }
+  
+  /* Index the entries by path */
+  for(c->mask = 15; c->mask < 2 * c->cnt; c->mask = 2 * c->mask + 1);
+  c->table = (int *)malloc((c->mask + 1) * sizeof(int));
+  for(i = 0; i <= c->mask; i++) c->table[i] = -1;
+  for(i = 0; i < c->cnt; i++) {
+   for(j = hash_bytes(c->path[i], strlen(c->path[i])) & c->mask; c->table[j] >= 0; j = (j + 1) & c->mask);
+   c->table[j] = i;
+  }
+}
+
+/*
+ * Return the cached profile of document 'name' if it is
+ * unchanged, setting 'content' to its content hash, or NULL
+ */
+uchar *cache_lookup(profile_cache *c, char *name, file_info info, unsigned long long *content)
+{
+  int i, j;
+  
+  unsigned long long hash_file(char *);
+  
+  for(j = hash_bytes(name, strlen(name)) & c->mask; (i = c->table[j]) >= 0; j = (j + 1) & c->mask)
+    if(!strcmp(c->path[i], name)) break;
+  if(i < 0 || c->info[i].size != info.size || c->info[i].mtime != info.mtime) return NULL;
+  if(c->verify && (!c->content[i] || hash_file(name) != c->content[i])) return NULL;
+  *content = c->content[i];
+  c->hits++;
+  return c->profiles + (size_t) i * c->dict_size;
+}
+
+/*
+ * Replace profile cache 'name' with the profiles of this run.
+ * The new cache is written aside and renamed over the old one,
+ * so a crash never leaves a truncated cache
+ */
+void save_cache(char *name, profile_cache *c, doc_list *docs, int dict_size)
+{
+  FILE *cachefile;	/* Cache file pointer */
+  int cnt;		/* Entries written */
+  int head[2];		/* Magic and version */
+  int i;
+  int len;		/* Chars in path */
+  file_info info;	/* Size and time of document */
+  char *tmp_name;	/* Cache being written */
+  
+  unsigned long long hash_file(char *);
+  
+  tmp_name = (char *)malloc(strlen(name) + 5);
+  sprintf(tmp_name, "%s.tmp", name);
+  if((cachefile = fopen(tmp_name, "w")) == NULL) {
+   printf("Cannot write profile cache '%s'\n", tmp_name);
+   free(tmp_name);
+   return;
+  }
+  for(cnt = i = 0; i < docs->cnt; i++)
+    if(docs->vector[i] != NULL) cnt++;
+  head[0] = CACHE_MAGIC;
+  head[1] = CACHE_VERSION;
+  fwrite(head, sizeof(int), 2, cachefile);
+  fwrite(&dict_size, sizeof(int), 1, cachefile);
+  fwrite(&c->dict_hash, sizeof(c->dict_hash), 1, cachefile);
+  fwrite(&cnt, sizeof(int), 1, cachefile);
+  for(i = 0; i < docs->cnt; i++) {
+   if(docs->vector[i] == NULL) continue;
+   if(c->verify && !docs->content[i]) docs->content[i] = hash_file(docs->name[i]);
+   len = strlen(docs->name[i]);
+   info.size = docs->size[i];
+   info.mtime = docs->mtime[i];
+   fwrite(&len, sizeof(int), 1, cachefile);
+   fwrite(docs->name[i], 1, len, cachefile);
+   fwrite(&info, sizeof(file_info), 1, cachefile);
+   fwrite(&docs->content[i], sizeof(unsigned long long), 1, cachefile);
+   fwrite(docs->vector[i], 1, dict_size, cachefile);
+  }
+  if(fclose(cachefile) || rename(tmp_name, name))
+    printf("Cannot write profile cache '%s'\n", name);
+  free(tmp_name);
+}
@@ -1,39 +1,51 @@
 
 #include <stdio.h>
 #include "mpi.h"
+#include "blasMPI.h"
 
 #define N 4096
 
 int main(int argc, char * argv[]) {
-   
-  double sum, sum_local;
-  double a[N], b[N];
 
-  int i, n, numprocs, myid, my_first, my_last;
+  double sum;
+  double norm_a, norm_b;
+  block_vector a, b;	/* Only this process's block is stored */
+  reduction_batch r;	/* Pending scalar reductions */
+
+  int i, n, numprocs, myid;
 
   n = N;
 
   MPI_Init(&argc, &argv);
   MPI_Comm_size(MPI_COMM_WORLD, &numprocs);
   MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+  init_block_weights(MPI_COMM_WORLD);
 
-  my_first = myid * n/numprocs;
-  my_last = (myid + 1) * n/numprocs;
+  create_block_vector(n, MPI_COMM_WORLD, &a);
+  create_block_vector(n, MPI_COMM_WORLD, &b);
 
-  for(i = 0; i < n; i++)
+  for(i = 0; i < a.size; i++)
   {
-    a[i] = i * 0.5;
-    b[i] = i * 2.0;
+    a.v[i] = (a.low + i) * 0.5;
+    b.v[i] = (b.low + i) * 2.0;
   }
 
-  sum_local = 0;
-  for(i = my_first; i < my_last; i++)
-  {
-    sum_local = sum_local + a[i]*b[i];
+  /* a.b and |b| from one pass, |a| from another,
+   * all three reduced by a single MPI_Allreduce
+   */
+  init_reductions(&r, MPI_COMM_WORLD);
+  defer_dot_nrm2(&r, &a, &b, &sum, &norm_b);
+  defer_nrm2(&r, &a, &norm_a);
+  flush_reductions(&r);
+
+  if(!myid) {
+    printf("sum = %f\n", sum);
+    printf("|a| = %f, |b| = %f\n", norm_a, norm_b);
   }
-  MPI_Allreduce(&sum_local, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 
-  printf("sum = %f\n", sum);
+  free_block_vector(&a);
+  free_block_vector(&b);
+  my_finalize();
 
   return 0;
-}
\ No newline at end of file
+}
@@ -45,6 +45,7 @@ int main(int argc, char * argv[]) {
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  init_block_weights(MPI_COMM_WORLD);
   
   read_row_striped_matrix(argv[1], (void *)&a, (void *)&storage,
 			  MPI_TYPE, &m, &n, MPI_COMM_WORLD);
@@ -57,7 +58,7 @@ int main(int argc, char * argv[]) {
   print_row_striped_matrix((void **)a, MPI_TYPE, m, n,
     MPI_COMM_WORLD);
   
-  MPI_Finalize();
+  my_finalize();
   
   exit(0);
 }
@@ -70,19 +71,19 @@ void compute_shortest_paths(int id, int p, dtype **a, int n) {
   int *tmp;		/* Holds the broadcast row */
   
   
-  tmp = (dtype *)malloc(n * sizeof(dtype));
+  tmp = (dtype *)my_malloc(id, n * sizeof(dtype));
   for(k = 0; k < n; k++) {
-    root = BLOCK_OWNER(k, p, n);
+    root = block_owner(k, p, n, MPI_COMM_WORLD);
     if(root == id) {
-      offset = k * BLOCK_LOW(id, p, n);
+      offset = k - block_low(id, p, n, MPI_COMM_WORLD);
       for(j = 0; j < n; j++)
 	tmp[j] = a[offset][j];
     }
-    MPI_Bcast(tmp, n, MPI_TYPE, root, MPI_COMM_WORLD);
-    for(i = 0; i < BLOCK_SIZE(id, p, n); i++)
+    hier_bcast(tmp, n, MPI_TYPE, root, MPI_COMM_WORLD);
+    for(i = 0; i < block_size(id, p, n, MPI_COMM_WORLD); i++)
       for(j = 0; j < n; j++)
 	a[i][j] = MIN(a[i][j], a[i][k] + tmp[j]);
   }
-  free(tmp);
+  my_free(tmp);
 }
 
@@ -11,6 +11,55 @@
  * Author: Michael Quinn
  * 
  * Last modification: 12 May 2016
+ *
+ * Memory: every block from 'my_malloc' is 64-byte aligned
+ * and accounted per process; release it with 'my_free'.
+ * Blocks of at least 2 MB may be backed by transparent huge
+ * pages (HELPERS_HUGE_PAGES=1). Helpers reuse scratch
+ * buffers and cached count/displacement arrays instead of
+ * allocating on every call, and a matrix's row pointers
+ * share one block with its elements. With
+ * HELPERS_MEM_REPORT=1, 'my_finalize' prints every
+ * process's high-water mark.
+ *
+ * Communication: the 'hier_' collectives work in two
+ * levels, within nodes and among one leader per node, over
+ * a node split cached on the communicator. The readers,
+ * 'replicate_block_vector' and 'print_block_vector' use them.
+ *
+ * Compression: with HELPERS_COMPRESS=lossless|float|bf16 the
+ * int and double payloads crossing nodes (the leaders' step
+ * of 'hier_bcast' and of the allgathervs) and those of
+ * 'compressed_alltoallv' are coded with compressMPI.h.
+ * Integers are always coded losslessly; 'float' and 'bf16'
+ * round doubles for the transfer only, the same way on every
+ * process, so replicas stay identical. 'my_finalize' reports
+ * the ratio achieved and the estimated time saved.
+ *
+ * Decomposition: the readers, the xfer arrays and the print
+ * functions split data with 'block_low' and friends, which
+ * give each process a share proportional to its weight.
+ * Weights are given or measured (HELPERS_WEIGHTS, see
+ * 'init_block_weights'); without them the split is even.
+ *
+ * Streaming: 'stream_row_striped_matrix' hands each process
+ * its block of rows a chunk at a time, from two buffers: the
+ * next chunk is read with MPI_File_iread_at while the caller
+ * works on the current one, so a matrix need not fit in
+ * memory.
+ *
+ * Layouts: 'redistribute_matrix' moves a distributed matrix
+ * among the row-striped, column-striped and checkerboard
+ * layouts, transposing it on the way if asked, in one
+ * MPI_Alltoallw whose subarray types read and write the
+ * blocks in place.
+ *
+ * Files: besides the legacy format (two ints, then the
+ * elements row by row) the matrix readers accept the tiled
+ * container of tiledMPI.h, where every process reads just
+ * the tiles its block needs and checks their CRCs.
+ * 'write_tiled_matrix' and 'write_legacy_matrix' write a
+ * distributed matrix in either format.
  */
 
 #define DATA_MSG		0
@@ -21,12 +70,44 @@
 #define MALLOC_ERROR		-2
 #define TYPE_ERROR		-3
 
-/* block decomposition macros */
+#define ALIGNMENT		64		/* Bytes, for SIMD loads */
+#define HUGE_PAGE		(2 * 1024 * 1024)
+#define SCRATCH_SLOTS		4
+#ifndef READ_CHUNK
+#define READ_CHUNK		(1 << 22)	/* Bytes a reader holds in transit */
+#endif
+
+/* Largest count passed to an MPI call as an int; larger
+ * transfers use MPI-4 large-count calls or a derived type
+ */
+#ifndef MAX_COUNT
+#define MAX_COUNT		INT_MAX
+#endif
+#ifndef BIG_CHUNK
+#define BIG_CHUNK		(1 << 30)	/* Elements per block of a large-count type */
+#endif
+
+/* Scratch buffers used by the helpers */
+#define SCRATCH_ROW		0	/* One matrix row or vector block */
+#define SCRATCH_BLOCK		1	/* A block of matrix rows */
+#define SCRATCH_CODEC		2	/* Work space of a codec */
+#define SCRATCH_PACKED		3	/* A compressed payload */
+
+/* Layouts of a distributed matrix */
+#define LAYOUT_ROWS		0	/* Blocks of rows, as 'read_row_striped_matrix' */
+#define LAYOUT_COLS		1	/* Blocks of columns, as 'read_col_striped_matrix' */
+#define LAYOUT_CHECKERBOARD	2	/* Blocks of both on a Cartesian grid */
+
+/* block decomposition macros
+ *
+ * Evaluated in 64 bits, so (id) * (n) cannot overflow for
+ * arrays of more than 2^31 elements
+ */
 
 /* expands to an expression whose value is the first, or lowest,
  * index controlled by the process
  */
-#define BLOCK_LOW(id, p, n) ((id) * (n) / (p))
+#define BLOCK_LOW(id, p, n) ((long long) (id) * (n) / (p))
 
 /* expands to an expression whose value is the last, or highest,
  * index controlled by the process
@@ -40,16 +121,107 @@
 /* evaluates to the rank of the process controlling that element
  * of the array
  */
-#define BLOCK_OWNER(index, p, n) (((p) * ((index) + 1) - 1) / (n))
+#define BLOCK_OWNER(index, p, n) ((int) (((long long) (p) * ((index) + 1) - 1) / (n)))
+
+/* The functions 'block_low', 'block_high', 'block_size' and
+ * 'block_owner' are the same decomposition, weighted by
+ * process speed once 'set_block_weights' has been called on
+ * the communicator they are given
+ */
+
+#define CALIBRATE_ELEMS		(1 << 19)	/* Doubles swept by the calibration */
+#define CALIBRATE_SECONDS	0.05		/* Its length */
 
 /* auxilliary macros */
 #define MIN(a,b)	((a) < (b) ? (a) : (b))
+#define MAX(a,b)	((a) > (b) ? (a) : (b))
 #define PTR_SIZE	(sizeof(void*))
 #define CEILING(i,j)	(((i) + (j) - 1) / (j))
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
 #include <mpi.h>
+#include "compressMPI.h"
+#include "tiledMPI.h"
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/* Precedes every block from 'my_malloc' */
+typedef struct {
+  size_t bytes;		/* Size requested */
+  void *base;		/* Address to pass to free */
+  int huge;		/* Huge pages requested */
+} block_header;
+
+/* How a communicator maps onto nodes */
+typedef struct {
+  MPI_Comm node;	/* Processes on this node */
+  MPI_Comm leaders;	/* Node leaders; MPI_COMM_NULL elsewhere */
+  int nodes;		/* Number of nodes */
+  int my_node;		/* This node: its leader's rank in 'leaders' */
+  int node_size;	/* Processes on this node */
+  int *node_of;		/* Node of each process */
+  int *node_rank;	/* Rank of each process on its node */
+  int *leader;		/* Rank of each node's leader */
+  int contiguous;	/* Every node holds consecutive ranks */
+} hier_info;
+
+/* Memory shared by the processes of a node */
+typedef struct {
+  MPI_Win win;		/* Shared memory window */
+  MPI_Comm node;	/* Processes on this node (cached) */
+  MPI_Comm leaders;	/* Node leaders (cached) */
+} shared_segment;
+
+/* Count and displacement arrays kept for reuse */
+typedef struct xfer_entry {
+  int uniform;		/* Uniform or mixed arrays */
+  int id, p, n;		/* What they were made for */
+  double *weights;	/* Weights of the communicator, or NULL */
+  int *count, *disp;
+  struct xfer_entry *next;
+} xfer_entry;
+
+/* Statistics of a streamed read */
+typedef struct {
+  long long bytes;	/* Read by this process */
+  double seconds;	/* Whole pass */
+  double wait;		/* Spent waiting for reads */
+} stream_stats;
+
+/* Works on 'count' rows of 'n' elements, the first being
+ * row 'first' of the matrix
+ */
+typedef void (*row_consumer)(void *rows, long long first, int count, int n, void *arg);
+
+/* Memory accounting of this process */
+size_t mem_current;	/* Bytes allocated now */
+size_t mem_peak;	/* High-water mark */
+long mem_allocs;	/* Calls to 'my_malloc' */
+long mem_huge;		/* Blocks given huge pages */
+int huge_pages = -1;	/* Use huge pages; -1: ask environment */
+
+void *scratch[SCRATCH_SLOTS];		/* Scratch buffers */
+size_t scratch_bytes[SCRATCH_SLOTS];	/* Their sizes */
+xfer_entry *xfer_cache;			/* Cached xfer arrays */
+int hier_keyval = MPI_KEYVAL_INVALID;	/* Attribute holding a hier_info */
+
+/* Weighted decomposition */
+int weights_keyval = MPI_KEYVAL_INVALID;	/* Attribute holding block weights */
+volatile double calibrate_sink;	/* Keeps the calibration sweep live */
+
+/* Compression accounting of this process */
+int compress_mode = -1;		/* COMPRESS_...; -1: ask environment */
+double comp_raw;		/* Bytes before coding */
+double comp_packed;		/* Bytes after coding */
+double comp_code_seconds;	/* Coding and decoding */
+double comp_comm_seconds;	/* Moving coded payloads */
+
+void print_subvector(void *, MPI_Datatype, int);
+void compression_report(void);
 
 /* Utility functions */
 
@@ -58,7 +230,7 @@
  * the size of a single datum of that data type
  */
 int get_size(MPI_Datatype t) {
-  if(t == MPI_BYTE) return sizeof(char);
+  if(t == MPI_BYTE || t == MPI_CHAR) return sizeof(char);
   if(t == MPI_DOUBLE) return sizeof(double);
   if(t == MPI_FLOAT) return sizeof(float);
   if(t == MPI_INT) return sizeof(int);
@@ -72,19 +244,879 @@ int get_size(MPI_Datatype t) {
  * wants to allocate some space from the heap.
  * If the memory allocation fails, the process prints
  * an error message and then aborts execution of the
- * program
+ * program.
+ *
+ * The block is ALIGNMENT aligned and must be released
+ * with 'my_free'. Blocks of HUGE_PAGE bytes or more are
+ * huge page aligned and advised for transparent huge pages
+ * when enabled
  */
 void *my_malloc(
   int id,	/* IN - Process rank */
-  int bytes)	/* IN - Bytes to allocate */
+  size_t bytes)	/* IN - Bytes to allocate */
 {
-  void *buffer;
-  if((buffer = malloc((size_t) bytes)) == NULL) {
+  void *base = NULL;
+  block_header *h;
+  size_t align;
+  char *env;
+
+  if(huge_pages < 0)
+    huge_pages = (env = getenv("HELPERS_HUGE_PAGES")) != NULL && atoi(env) > 0;
+  align = huge_pages && bytes >= HUGE_PAGE ? HUGE_PAGE : ALIGNMENT;
+  if(posix_memalign(&base, align, bytes + ALIGNMENT)) {
    printf("Error: malloc failed for process %d\n", id);
    fflush(stdout);
    MPI_Abort(MPI_COMM_WORLD, MALLOC_ERROR);
   }
-  return buffer;
+  h = (block_header *) base;
+  h->bytes = bytes;
+  h->base = base;
+  h->huge = align == HUGE_PAGE;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+  if(h->huge) {
+    madvise(base, (bytes + ALIGNMENT + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE, MADV_HUGEPAGE);
+    mem_huge++;
+  }
+#endif
+  mem_allocs++;
+  mem_current += bytes;
+  if(mem_current > mem_peak) mem_peak = mem_current;
+  return (char *) base + ALIGNMENT;
+}
+
+/*
+ * Release a block obtained from 'my_malloc'
+ */
+void my_free(void *buffer)
+{
+  block_header *h;
+
+  if(buffer == NULL) return;
+  h = (block_header *) ((char *) buffer - ALIGNMENT);
+  mem_current -= h->bytes;
+  free(h->base);
+}
+
+/*
+ * Scratch buffer 'slot' of at least 'bytes' bytes. The
+ * buffer is kept and reused by later calls; its contents
+ * do not survive a call that has to grow it
+ */
+void *scratch_buffer(
+  int id,	/* IN - Process rank */
+  int slot,	/* IN - SCRATCH_ROW, SCRATCH_BLOCK, ... */
+  size_t bytes)	/* IN - Bytes needed */
+{
+  if(bytes > scratch_bytes[slot]) {
+    my_free(scratch[slot]);
+    scratch[slot] = my_malloc(id, bytes);
+    scratch_bytes[slot] = bytes;
+  }
+  return scratch[slot];
+}
+
+/*
+ * Give back scratch buffer 'slot', for a buffer too large
+ * to keep between calls
+ */
+void release_scratch(int slot)
+{
+  my_free(scratch[slot]);
+  scratch[slot] = NULL;
+  scratch_bytes[slot] = 0;
+}
+
+/*
+ * Allocate 'rows' x 'cols' elements and an array of row
+ * pointers into them as a single block. The row pointers
+ * go to '*subs'; releasing the returned storage with
+ * 'my_free' releases both
+ */
+void *alloc_matrix_block(
+  int id,		/* IN - Process rank */
+  int rows,		/* IN - Rows */
+  int cols,		/* IN - Columns */
+  int datum_size,	/* IN - Bytes per element */
+  void ***subs)		/* OUT - Row pointers */
+{
+  size_t data;		/* Bytes of elements, aligned */
+  char *storage;
+  int i;
+
+  data = CEILING((size_t) rows * cols * datum_size, ALIGNMENT) * ALIGNMENT;
+  storage = my_malloc(id, data + (size_t) rows * PTR_SIZE);
+  *subs = (void **) (storage + data);
+  for(i = 0; i < rows; i++)
+    (*subs)[i] = storage + (size_t) i * cols * datum_size;
+  return storage;
+}
+
+/*
+ * Finalize MPI. With HELPERS_MEM_REPORT=1 process 0 first
+ * prints the memory high-water mark of every process, and
+ * with compression on, what it achieved.
+ * 
+ * All processes must invoke this function together
+ */
+void my_finalize(void)
+{
+  double local[4];	/* Peak MB, current MB, blocks, huge blocks */
+  double *all;
+  char *env;
+  int i, id, p;
+
+  compression_report();
+  if((env = getenv("HELPERS_MEM_REPORT")) != NULL && atoi(env) > 0) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &id);
+    MPI_Comm_size(MPI_COMM_WORLD, &p);
+    local[0] = mem_peak / 1048576.0;
+    local[1] = mem_current / 1048576.0;
+    local[2] = mem_allocs;
+    local[3] = mem_huge;
+    all = !id ? malloc(4 * p * sizeof(double)) : NULL;
+    MPI_Gather(local, 4, MPI_DOUBLE, all, 4, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if(!id) {
+      printf("Rank    Peak MB  Live MB  Blocks   Huge\n");
+      for(i = 0; i < p; i++)
+        printf("%4d %10.3f %8.3f %7.0f %6.0f\n", i, all[4 * i], all[4 * i + 1], all[4 * i + 2], all[4 * i + 3]);
+      fflush(stdout);
+      free(all);
+    }
+  }
+  MPI_Finalize();
+}
+
+/* Large-count communication
+ *
+ * Counts are size_t. With MPI-4 the '_c' calls take them
+ * as they are; otherwise counts above MAX_COUNT are sent as
+ * one element of a derived type built from BIG_CHUNK-element
+ * blocks plus the remainder
+ */
+
+/*
+ * Datatype of 'count' consecutive elements of 'dtype'.
+ * Free it with MPI_Type_free
+ */
+MPI_Datatype large_count_type(
+  size_t count,		/* IN - Elements */
+  MPI_Datatype dtype)	/* IN - Element type */
+{
+  MPI_Datatype big;	/* The result */
+  MPI_Datatype chunk;	/* BIG_CHUNK elements */
+  MPI_Datatype parts[2];	/* Whole chunks, remainder */
+  int lens[2] = {1, 1};
+  MPI_Aint disp[2];
+  MPI_Aint extent, lb;
+
+  MPI_Type_get_extent(dtype, &lb, &extent);
+  MPI_Type_contiguous(BIG_CHUNK, dtype, &chunk);
+  MPI_Type_contiguous((int) (count / BIG_CHUNK), chunk, &parts[0]);
+  MPI_Type_contiguous((int) (count % BIG_CHUNK), dtype, &parts[1]);
+  disp[0] = 0;
+  disp[1] = (MPI_Aint) (count / BIG_CHUNK * BIG_CHUNK) * extent;
+  MPI_Type_create_struct(2, lens, disp, parts, &big);
+  MPI_Type_commit(&big);
+  MPI_Type_free(&chunk);
+  MPI_Type_free(&parts[0]);
+  MPI_Type_free(&parts[1]);
+  return big;
+}
+
+void big_send(void *buf, size_t count, MPI_Datatype dtype, int dest, int tag, MPI_Comm comm)
+{
+#if MPI_VERSION >= 4
+  MPI_Send_c(buf, (MPI_Count) count, dtype, dest, tag, comm);
+#else
+  MPI_Datatype big;
+
+  if(count <= MAX_COUNT) {
+    MPI_Send(buf, (int) count, dtype, dest, tag, comm);
+    return;
+  }
+  big = large_count_type(count, dtype);
+  MPI_Send(buf, 1, big, dest, tag, comm);
+  MPI_Type_free(&big);
+#endif
+}
+
+void big_recv(void *buf, size_t count, MPI_Datatype dtype, int src, int tag, MPI_Comm comm)
+{
+#if MPI_VERSION >= 4
+  MPI_Recv_c(buf, (MPI_Count) count, dtype, src, tag, comm, MPI_STATUS_IGNORE);
+#else
+  MPI_Datatype big;
+
+  if(count <= MAX_COUNT) {
+    MPI_Recv(buf, (int) count, dtype, src, tag, comm, MPI_STATUS_IGNORE);
+    return;
+  }
+  big = large_count_type(count, dtype);
+  MPI_Recv(buf, 1, big, src, tag, comm, MPI_STATUS_IGNORE);
+  MPI_Type_free(&big);
+#endif
+}
+
+void big_bcast(void *buf, size_t count, MPI_Datatype dtype, int root, MPI_Comm comm)
+{
+#if MPI_VERSION >= 4
+  MPI_Bcast_c(buf, (MPI_Count) count, dtype, root, comm);
+#else
+  MPI_Datatype big;
+
+  if(count <= MAX_COUNT) {
+    MPI_Bcast(buf, (int) count, dtype, root, comm);
+    return;
+  }
+  big = large_count_type(count, dtype);
+  MPI_Bcast(buf, 1, big, root, comm);
+  MPI_Type_free(&big);
+#endif
+}
+
+/*
+ * Linear scatter of runs of bytes with 64-bit counts: 'root'
+ * sends process i cnt[i] bytes from 'sendbuf' + disp[i]
+ */
+void scatter_bytes(
+  char *sendbuf,		/* IN - All runs (root) */
+  const long long *cnt,		/* IN - Bytes of each process (root) */
+  const long long *disp,	/* IN - Offset of each process (root) */
+  char *recvbuf,		/* OUT - This process's run */
+  long long bytes,		/* IN - Its bytes */
+  int root,			/* IN - Root process */
+  MPI_Comm comm)		/* IN - Communicator */
+{
+  int i, id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  if(id != root) {
+    big_recv(recvbuf, (size_t) bytes, MPI_BYTE, root, DATA_MSG, comm);
+    return;
+  }
+  for(i = 0; i < p; i++)
+    if(i != root) big_send(sendbuf + disp[i], (size_t) cnt[i], MPI_BYTE, i, DATA_MSG, comm);
+    else if(cnt[i]) memcpy(recvbuf, sendbuf + disp[i], (size_t) cnt[i]);
+}
+
+/*
+ * The reverse of 'scatter_bytes'
+ */
+void gather_bytes(
+  char *sendbuf,		/* IN - This process's run */
+  long long bytes,		/* IN - Its bytes */
+  char *recvbuf,		/* OUT - All runs (root) */
+  const long long *cnt,		/* IN - Bytes of each process (root) */
+  const long long *disp,	/* IN - Offset of each process (root) */
+  int root,			/* IN - Root process */
+  MPI_Comm comm)		/* IN - Communicator */
+{
+  int i, id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  if(id != root) {
+    big_send(sendbuf, (size_t) bytes, MPI_BYTE, root, DATA_MSG, comm);
+    return;
+  }
+  for(i = 0; i < p; i++)
+    if(i != root) big_recv(recvbuf + disp[i], (size_t) cnt[i], MPI_BYTE, i, DATA_MSG, comm);
+    else if(cnt[i]) memcpy(recvbuf + disp[i], sendbuf, (size_t) cnt[i]);
+}
+
+/* Payload compression
+ *
+ * Only MPI_INT and MPI_DOUBLE payloads are coded; others
+ * go as they are. Payloads are moved as bytes, so one coded
+ * payload must stay below 2 GB
+ */
+
+/*
+ * Compression applied to elements of 'dtype', read from
+ * HELPERS_COMPRESS on first use
+ */
+int payload_mode(MPI_Datatype dtype)
+{
+  char *env;
+
+  if(compress_mode < 0) {
+    env = getenv("HELPERS_COMPRESS");
+    compress_mode = COMPRESS_NONE;
+    if(env != NULL && !strcmp(env, "lossless")) compress_mode = COMPRESS_LOSSLESS;
+    else if(env != NULL && !strcmp(env, "float")) compress_mode = COMPRESS_FLOAT;
+    else if(env != NULL && !strcmp(env, "bf16")) compress_mode = COMPRESS_BF16;
+  }
+  if(dtype == MPI_DOUBLE) return compress_mode;
+  if(dtype == MPI_INT && sizeof(int) == 4) return compress_mode ? COMPRESS_LOSSLESS : COMPRESS_NONE;
+  return COMPRESS_NONE;
+}
+
+/*
+ * Code 'n' elements of 'dtype' into 'out', which must hold
+ * compress_bound(n, get_size(dtype)) bytes. Returns the
+ * payload bytes
+ */
+size_t pack_payload(void *v, size_t n, MPI_Datatype dtype, unsigned char *out)
+{
+  size_t width = get_size(dtype);
+  size_t len;
+  double t = MPI_Wtime();
+
+  len = compress_payload(v, n, width, dtype == MPI_INT, payload_mode(dtype), out,
+                         scratch_buffer(0, SCRATCH_CODEC, n * width + 1));
+  comp_raw += (double) n * width;
+  comp_packed += len;
+  comp_code_seconds += MPI_Wtime() - t;
+  return len;
+}
+
+void unpack_payload(unsigned char *in, size_t len, size_t n, MPI_Datatype dtype, void *v)
+{
+  size_t width = get_size(dtype);
+  double t = MPI_Wtime();
+
+  decompress_payload(in, len, n, width, v, scratch_buffer(0, SCRATCH_CODEC, n * width + 1));
+  comp_code_seconds += MPI_Wtime() - t;
+}
+
+/*
+ * Pass 'n' elements through the lossy codec in place, so a
+ * sender holds what its receivers will
+ */
+void round_trip_payload(void *v, size_t n, MPI_Datatype dtype)
+{
+  unsigned char *packed;
+  size_t len;
+
+  if(payload_mode(dtype) < COMPRESS_FLOAT) return;
+  packed = scratch_buffer(0, SCRATCH_PACKED, compress_bound(n, get_size(dtype)));
+  len = pack_payload(v, n, dtype, packed);
+  unpack_payload(packed, len, n, dtype, v);
+}
+
+/*
+ * MPI_Bcast of a coded payload: its size, then its bytes
+ */
+void compressed_bcast(void *buf, size_t count, MPI_Datatype dtype, int root, MPI_Comm comm)
+{
+  unsigned char *packed;
+  int id, len = 0;
+  double t;
+
+  MPI_Comm_rank(comm, &id);
+  packed = scratch_buffer(id, SCRATCH_PACKED, compress_bound(count, get_size(dtype)));
+  if(id == root) len = (int) pack_payload(buf, count, dtype, packed);
+  t = MPI_Wtime();
+  MPI_Bcast(&len, 1, MPI_INT, root, comm);
+  MPI_Bcast(packed, len, MPI_BYTE, root, comm);
+  comp_comm_seconds += MPI_Wtime() - t;
+  if(id != root) unpack_payload(packed, len, count, dtype, buf);
+}
+
+/*
+ * MPI_Alltoallv (same type on both sides) whose blocks are
+ * coded when compression is on; plain MPI_Alltoallv when
+ * it is off
+ */
+void compressed_alltoallv(
+  void *sendbuf,	/* IN - Blocks to send */
+  const int *scnt,	/* IN - Elements to each process */
+  const int *sdisp,	/* IN - Their displacements */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void *recvbuf,	/* OUT - Blocks received */
+  const int *rcnt,	/* IN - Elements from each process */
+  const int *rdisp,	/* IN - Their displacements */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  int *sbytes, *soff;	/* Coded blocks sent */
+  int *rbytes, *roff;	/* Coded blocks received */
+  unsigned char *out, *in;
+  size_t width, total;
+  int i, id, p;
+  double t;
+
+  if(!payload_mode(dtype)) {
+    MPI_Alltoallv(sendbuf, scnt, sdisp, dtype, recvbuf, rcnt, rdisp, dtype, comm);
+    return;
+  }
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  width = get_size(dtype);
+  sbytes = my_malloc(id, 4 * p * sizeof(int));
+  soff = sbytes + p;
+  rbytes = soff + p;
+  roff = rbytes + p;
+  for(total = 0, i = 0; i < p; i++) total += compress_bound(scnt[i], width);
+  out = my_malloc(id, total);
+  for(total = 0, i = 0; i < p; i++) {
+    soff[i] = (int) total;
+    sbytes[i] = (int) pack_payload((char *) sendbuf + (size_t) sdisp[i] * width, scnt[i], dtype, out + total);
+    total += sbytes[i];
+  }
+
+  t = MPI_Wtime();
+  MPI_Alltoall(sbytes, 1, MPI_INT, rbytes, 1, MPI_INT, comm);
+  for(total = 0, i = 0; i < p; i++) {
+    roff[i] = (int) total;
+    total += rbytes[i];
+  }
+  in = my_malloc(id, total);
+  MPI_Alltoallv(out, sbytes, soff, MPI_BYTE, in, rbytes, roff, MPI_BYTE, comm);
+  comp_comm_seconds += MPI_Wtime() - t;
+
+  for(i = 0; i < p; i++)
+    unpack_payload(in + roff[i], rbytes[i], rcnt[i], dtype, (char *) recvbuf + (size_t) rdisp[i] * width);
+  my_free(in);
+  my_free(out);
+  my_free(sbytes);
+}
+
+/*
+ * Process 0 prints the compression achieved over all
+ * processes and the transfer time it saved, estimated from
+ * the time spent moving coded payloads at the same rate.
+ * 
+ * All processes must invoke this function together
+ */
+void compression_report(void)
+{
+  double local[4], sum[4];	/* Raw, packed, coding s, transfer s */
+  double ratio, saved;
+  int id, p;
+  char *name[] = { "none", "lossless", "float", "bf16" };
+
+  if(payload_mode(MPI_DOUBLE) == COMPRESS_NONE) return;
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  local[0] = comp_raw;
+  local[1] = comp_packed;
+  local[2] = comp_code_seconds;
+  local[3] = comp_comm_seconds;
+  MPI_Reduce(local, sum, 4, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+  if(!id) {
+    ratio = sum[1] > 0.0 ? sum[0] / sum[1] : 1.0;
+    saved = sum[3] / p * (ratio - 1.0);
+    printf("Compression (%s): %.3f MB coded to %.3f MB, ratio %.2f\n",
+           name[compress_mode], sum[0] / 1048576.0, sum[1] / 1048576.0, ratio);
+    printf("Per process: coding %.6f s, transfers %.6f s, est. saved %.6f s (net %.6f s)\n",
+           sum[2] / p, sum[3] / p, saved, saved - sum[2] / p);
+    fflush(stdout);
+  }
+}
+
+/* Hierarchical collectives
+ *
+ * A communicator is split once into its nodes (processes
+ * that share memory) and the leaders of those nodes (node
+ * rank 0). The split is cached on the communicator as an
+ * attribute and freed with it. A 'hier_' collective is an
+ * intra-node step, a step among the leaders and another
+ * intra-node step, so only one process per node uses the
+ * network. Reductions assume a commutative operation.
+ * Counts and displacements are in elements of a contiguous
+ * datatype, as in MPI. Byte counts of whole nodes are 64-bit
+ * and those runs move with 'big_send' and 'big_recv'
+ */
+
+int free_hier_info(MPI_Comm comm, int keyval, void *attr, void *extra)
+{
+  hier_info *h = (hier_info *) attr;
+
+  MPI_Comm_free(&h->node);
+  if(h->leaders != MPI_COMM_NULL) MPI_Comm_free(&h->leaders);
+  my_free(h->node_of);
+  my_free(h);
+  return MPI_SUCCESS;
+}
+
+/*
+ * The node structure of 'comm', computed on first use.
+ * 
+ * All processes must invoke this function together
+ */
+hier_info *get_hier_info(MPI_Comm comm)
+{
+  int found;		/* Already cached */
+  hier_info *h;
+  int i, id, p;
+  int pair[2];		/* Node, rank on node */
+  int *all;		/* Pairs of all processes */
+
+  if(hier_keyval == MPI_KEYVAL_INVALID)
+    MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, free_hier_info, &hier_keyval, NULL);
+  MPI_Comm_get_attr(comm, hier_keyval, &h, &found);
+  if(found) return h;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  h = my_malloc(id, sizeof(hier_info));
+  MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, id, MPI_INFO_NULL, &h->node);
+  MPI_Comm_rank(h->node, &pair[1]);
+  MPI_Comm_size(h->node, &h->node_size);
+  MPI_Comm_split(comm, pair[1] ? MPI_UNDEFINED : 0, id, &h->leaders);
+  pair[0] = 0;
+  if(h->leaders != MPI_COMM_NULL) MPI_Comm_rank(h->leaders, &pair[0]);
+  MPI_Bcast(&pair[0], 1, MPI_INT, 0, h->node);
+  h->my_node = pair[0];
+
+  all = my_malloc(id, 2 * p * sizeof(int));
+  MPI_Allgather(pair, 2, MPI_INT, all, 2, MPI_INT, comm);
+  h->node_of = my_malloc(id, 3 * p * sizeof(int));
+  h->node_rank = h->node_of + p;
+  h->leader = h->node_rank + p;
+  h->nodes = 0;
+  h->contiguous = 1;
+  for(i = 0; i < p; i++) {
+    h->node_of[i] = all[2 * i];
+    h->node_rank[i] = all[2 * i + 1];
+    if(!h->node_rank[i]) h->leader[h->node_of[i]] = i;
+    if(h->node_of[i] >= h->nodes) h->nodes = h->node_of[i] + 1;
+    if(i && h->node_of[i] != h->node_of[i - 1] && h->node_of[i] != h->node_of[i - 1] + 1)
+      h->contiguous = 0;
+  }
+  my_free(all);
+  MPI_Comm_set_attr(comm, hier_keyval, h);
+  return h;
+}
+
+/*
+ * Copy between the blocks of node 'j' in 'base' (element
+ * counts 'cnt', displacements 'disp') and one packed run of
+ * bytes at 'packed'. Returns the bytes packed
+ */
+size_t pack_node_blocks(
+  hier_info *h,		/* IN - Node structure */
+  int p,		/* IN - Processes */
+  int j,		/* IN - Node */
+  const int *cnt,	/* IN - Elements of each process */
+  const int *disp,	/* IN - Displacement of each process */
+  MPI_Aint extent,	/* IN - Bytes per element */
+  char *base,		/* IN/OUT - Blocks */
+  char *packed,		/* IN/OUT - Packed run */
+  int unpack)		/* IN - Direction */
+{
+  size_t off = 0;
+  int i;
+
+  for(i = 0; i < p; i++)
+    if(h->node_of[i] == j) {
+      if(unpack) memcpy(base + disp[i] * extent, packed + off, cnt[i] * extent);
+      else memcpy(packed + off, base + disp[i] * extent, cnt[i] * extent);
+      off += cnt[i] * extent;
+    }
+  return off;
+}
+
+/*
+ * Leaders' step of an allgatherv: each leader holds its own
+ * node's blocks in 'buf' and ends with all of them. When the
+ * nodes hold consecutive ranks and the blocks are in rank
+ * order, a node's blocks are one run and go as they are;
+ * otherwise they are packed. With compression on, each
+ * node's packed run is coded
+ */
+void leaders_allgatherv(
+  hier_info *h,		/* IN - Node structure */
+  void *buf,		/* IN/OUT - Blocks */
+  const int *cnt,	/* IN - Elements of each process */
+  const int *disp,	/* IN - Displacement of each process */
+  MPI_Datatype dtype,	/* IN - Element type */
+  int p)		/* IN - Processes */
+{
+  int i, j;
+  int in_order;		/* Blocks one after another */
+  MPI_Aint extent, lb;
+  int *lcnt, *ldisp;	/* Per node */
+  int *nelems, most;	/* Elements per node, most of them */
+  char *packed;
+  char *raw;		/* One node's blocks */
+  unsigned char *coded;	/* This node's coded blocks */
+  int len;
+  double t;
+
+  if(h->leaders == MPI_COMM_NULL || h->nodes < 2) return;
+  MPI_Type_get_extent(dtype, &lb, &extent);
+  lcnt = my_malloc(0, 3 * h->nodes * sizeof(int));
+  ldisp = lcnt + h->nodes;
+  nelems = ldisp + h->nodes;
+  for(in_order = h->contiguous, i = 1; i < p; i++)
+    if(disp[i] != disp[i - 1] + cnt[i - 1]) in_order = 0;
+
+  if(payload_mode(dtype) != COMPRESS_NONE) {
+    for(most = j = 0; j < h->nodes; j++) nelems[j] = 0;
+    for(i = 0; i < p; i++) nelems[h->node_of[i]] += cnt[i];
+    for(j = 0; j < h->nodes; j++) if(nelems[j] > most) most = nelems[j];
+    raw = my_malloc(0, (size_t) most * extent + 1);
+    coded = my_malloc(0, compress_bound(most, extent));
+    pack_node_blocks(h, p, h->my_node, cnt, disp, extent, buf, raw, 0);
+    len = (int) pack_payload(raw, nelems[h->my_node], dtype, coded);
+    t = MPI_Wtime();
+    MPI_Allgather(&len, 1, MPI_INT, lcnt, 1, MPI_INT, h->leaders);
+    ldisp[0] = 0;
+    for(j = 1; j < h->nodes; j++) ldisp[j] = ldisp[j - 1] + lcnt[j - 1];
+    packed = my_malloc(0, (size_t) ldisp[h->nodes - 1] + lcnt[h->nodes - 1]);
+    MPI_Allgatherv(coded, len, MPI_BYTE, packed, lcnt, ldisp, MPI_BYTE, h->leaders);
+    comp_comm_seconds += MPI_Wtime() - t;
+    for(j = 0; j < h->nodes; j++)	/* Own node too when lossy, to match the others */
+      if(j != h->my_node || payload_mode(dtype) >= COMPRESS_FLOAT) {
+        unpack_payload((unsigned char *) packed + ldisp[j], lcnt[j], nelems[j], dtype, raw);
+        pack_node_blocks(h, p, j, cnt, disp, extent, buf, raw, 1);
+      }
+    my_free(packed);
+    my_free(coded);
+    my_free(raw);
+  } else if(in_order) {
+    for(j = 0; j < h->nodes; j++) lcnt[j] = 0;
+    for(i = 0; i < p; i++) {
+      if(!lcnt[h->node_of[i]]) ldisp[h->node_of[i]] = disp[i];
+      lcnt[h->node_of[i]] += cnt[i];
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, dtype, buf, lcnt, ldisp, dtype, h->leaders);
+  } else {
+    for(j = 0; j < h->nodes; j++) lcnt[j] = 0;
+    for(i = 0; i < p; i++) lcnt[h->node_of[i]] += cnt[i];
+    ldisp[0] = 0;
+    for(j = 1; j < h->nodes; j++) ldisp[j] = ldisp[j - 1] + lcnt[j - 1];
+    packed = my_malloc(0, ((size_t) ldisp[h->nodes - 1] + lcnt[h->nodes - 1]) * extent);
+    pack_node_blocks(h, p, h->my_node, cnt, disp, extent, buf, packed + (size_t) ldisp[h->my_node] * extent, 0);
+    MPI_Allgatherv(MPI_IN_PLACE, 0, dtype, packed, lcnt, ldisp, dtype, h->leaders);
+    for(j = 0; j < h->nodes; j++)
+      if(j != h->my_node) pack_node_blocks(h, p, j, cnt, disp, extent, buf, packed + (size_t) ldisp[j] * extent, 1);
+    my_free(packed);
+  }
+  my_free(lcnt);
+}
+
+/*
+ * Two-level MPI_Bcast: within the root's node, among the
+ * leaders, then within the other nodes. With compression on,
+ * the leaders' step is coded
+ */
+void hier_bcast(void *buf, size_t count, MPI_Datatype dtype, int root, MPI_Comm comm)
+{
+  hier_info *h = get_hier_info(comm);
+  int root_node = h->node_of[root];
+  int id, coded;	/* Leaders' step compressed */
+
+  MPI_Comm_rank(comm, &id);
+  coded = h->nodes > 1 && payload_mode(dtype) != COMPRESS_NONE;
+  if(coded && id == root) round_trip_payload(buf, count, dtype);
+  if(h->my_node == root_node)
+    big_bcast(buf, count, dtype, h->node_rank[root], h->node);
+  if(h->leaders != MPI_COMM_NULL && h->nodes > 1) {
+    if(coded) compressed_bcast(buf, count, dtype, root_node, h->leaders);
+    else big_bcast(buf, count, dtype, root_node, h->leaders);
+  }
+  if(h->my_node != root_node)
+    big_bcast(buf, count, dtype, 0, h->node);
+}
+
+/*
+ * Two-level MPI_Allreduce: reduce on each node's leader,
+ * allreduce among the leaders, broadcast on each node.
+ * 'sendbuf' may be MPI_IN_PLACE
+ */
+void hier_allreduce(void *sendbuf, void *recvbuf, int count, MPI_Datatype dtype, MPI_Op op, MPI_Comm comm)
+{
+  hier_info *h = get_hier_info(comm);
+
+  if(h->leaders != MPI_COMM_NULL)
+    MPI_Reduce(sendbuf, recvbuf, count, dtype, op, 0, h->node);
+  else
+    MPI_Reduce(sendbuf == MPI_IN_PLACE ? recvbuf : sendbuf, NULL, count, dtype, op, 0, h->node);
+  if(h->leaders != MPI_COMM_NULL && h->nodes > 1)
+    MPI_Allreduce(MPI_IN_PLACE, recvbuf, count, dtype, op, h->leaders);
+  MPI_Bcast(recvbuf, count, dtype, 0, h->node);
+}
+
+/*
+ * Two-level MPI_Allgatherv (same type on both sides):
+ * gather each node's blocks on its leader, exchange them
+ * among the leaders, broadcast the result on each node
+ */
+void hier_allgatherv(
+  void *sendbuf,	/* IN - This process's block */
+  int sendcount,	/* IN - Its elements */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void *recvbuf,	/* OUT - All blocks */
+  const int *cnt,	/* IN - Elements of each process */
+  const int *disp,	/* IN - Displacement of each process */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  MPI_Datatype all;	/* Every block of 'recvbuf' */
+  hier_info *h = get_hier_info(comm);
+  int i, k, id, p;
+  int *ncnt, *ndisp;	/* Blocks of this node's processes */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  ncnt = my_malloc(id, 2 * h->node_size * sizeof(int));
+  ndisp = ncnt + h->node_size;
+  for(k = i = 0; i < p; i++)
+    if(h->node_of[i] == h->my_node) {
+      ncnt[k] = cnt[i];
+      ndisp[k++] = disp[i];
+    }
+  MPI_Gatherv(sendbuf, sendcount, dtype, recvbuf, ncnt, ndisp, dtype, 0, h->node);
+  my_free(ncnt);
+
+  leaders_allgatherv(h, recvbuf, cnt, disp, dtype, p);
+
+  if(h->node_size > 1) {
+    MPI_Type_indexed(p, (int *) cnt, (int *) disp, dtype, &all);
+    MPI_Type_commit(&all);
+    MPI_Bcast(recvbuf, 1, all, 0, h->node);
+    MPI_Type_free(&all);
+  }
+}
+
+/*
+ * Two-level MPI_Scatterv (same type on both sides): the
+ * root packs the blocks node by node, the leaders scatter
+ * whole nodes' shares, then scatter them on their nodes.
+ * 'cnt' and 'disp' are significant only at the root
+ */
+void hier_scatterv(
+  void *sendbuf,	/* IN - All blocks (root) */
+  const int *cnt,	/* IN - Elements of each process (root) */
+  const int *disp,	/* IN - Displacement of each process (root) */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void *recvbuf,	/* OUT - This process's block */
+  int recvcount,	/* IN - Its elements */
+  int root,		/* IN - Root process */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  long long bytes;	/* Of this process's block */
+  MPI_Aint extent, lb;
+  hier_info *h = get_hier_info(comm);
+  int i, j, id, p;
+  long long *lcnt = NULL;	/* Bytes per node, their offsets */
+  long long *mcnt = NULL;	/* Bytes per process on this node, offsets */
+  char *nodebuf = NULL;	/* This node's share, on its leader */
+  char *packed = NULL;	/* All shares, on the root's leader */
+  int root_leader;	/* Leader of the root's node */
+  long long total;	/* Bytes of this node's share */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  MPI_Type_get_extent(dtype, &lb, &extent);
+  root_leader = h->leader[h->node_of[root]];
+
+  /* The root packs, and hands the packet to its leader */
+  if(id == root || id == root_leader) lcnt = my_malloc(id, 2 * h->nodes * sizeof(long long));
+  if(id == root) {
+    for(j = 0; j < h->nodes; j++) lcnt[j] = 0;
+    for(i = 0; i < p; i++) lcnt[h->node_of[i]] += (long long) cnt[i] * extent;
+    lcnt[h->nodes] = 0;
+    for(j = 1; j < h->nodes; j++) lcnt[h->nodes + j] = lcnt[h->nodes + j - 1] + lcnt[j - 1];
+    packed = my_malloc(id, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]));
+    for(j = 0; j < h->nodes; j++)
+      pack_node_blocks(h, p, j, cnt, disp, extent, sendbuf, packed + lcnt[h->nodes + j], 0);
+    if(root != root_leader) {
+      MPI_Send(lcnt, 2 * h->nodes, MPI_LONG_LONG, root_leader, DATA_MSG, comm);
+      big_send(packed, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]), MPI_BYTE, root_leader, DATA_MSG, comm);
+    }
+  } else if(id == root_leader) {
+    MPI_Recv(lcnt, 2 * h->nodes, MPI_LONG_LONG, root, DATA_MSG, comm, MPI_STATUS_IGNORE);
+    packed = my_malloc(id, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]));
+    big_recv(packed, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]), MPI_BYTE, root, DATA_MSG, comm);
+  }
+
+  /* Leaders learn their processes' sizes and get the node's share */
+  bytes = (long long) recvcount * extent;
+  if(h->leaders != MPI_COMM_NULL) mcnt = my_malloc(id, 2 * h->node_size * sizeof(long long));
+  MPI_Gather(&bytes, 1, MPI_LONG_LONG, mcnt, 1, MPI_LONG_LONG, 0, h->node);
+  if(h->leaders != MPI_COMM_NULL) {
+    mcnt[h->node_size] = 0;
+    for(i = 1; i < h->node_size; i++) mcnt[h->node_size + i] = mcnt[h->node_size + i - 1] + mcnt[i - 1];
+    total = mcnt[2 * h->node_size - 1] + mcnt[h->node_size - 1];
+    nodebuf = my_malloc(id, total ? (size_t) total : 1);
+    scatter_bytes(packed, lcnt, lcnt == NULL ? NULL : lcnt + h->nodes, nodebuf, total, h->node_of[root], h->leaders);
+  }
+  scatter_bytes(nodebuf, mcnt, mcnt == NULL ? NULL : mcnt + h->node_size, recvbuf, bytes, 0, h->node);
+
+  my_free(lcnt);
+  my_free(mcnt);
+  my_free(nodebuf);
+  my_free(packed);
+}
+
+/*
+ * Two-level MPI_Gatherv (same type on both sides), the
+ * reverse of 'hier_scatterv'. 'cnt' and 'disp' are
+ * significant only at the root
+ */
+void hier_gatherv(
+  void *sendbuf,	/* IN - This process's block */
+  int sendcount,	/* IN - Its elements */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void *recvbuf,	/* OUT - All blocks (root) */
+  const int *cnt,	/* IN - Elements of each process (root) */
+  const int *disp,	/* IN - Displacement of each process (root) */
+  int root,		/* IN - Root process */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  long long bytes;	/* Of this process's block */
+  MPI_Aint extent, lb;
+  hier_info *h = get_hier_info(comm);
+  int i, j, id, p;
+  long long *lcnt = NULL;	/* Bytes per node, their offsets */
+  long long *mcnt = NULL;	/* Bytes per process on this node, offsets */
+  char *nodebuf = NULL;	/* This node's blocks, on its leader */
+  char *packed = NULL;	/* All blocks, on the root's leader */
+  int root_leader;	/* Leader of the root's node */
+  long long total;	/* Bytes of this node's blocks */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  MPI_Type_get_extent(dtype, &lb, &extent);
+  root_leader = h->leader[h->node_of[root]];
+
+  /* Each leader collects its node's blocks */
+  bytes = (long long) sendcount * extent;
+  if(h->leaders != MPI_COMM_NULL) mcnt = my_malloc(id, 2 * h->node_size * sizeof(long long));
+  MPI_Gather(&bytes, 1, MPI_LONG_LONG, mcnt, 1, MPI_LONG_LONG, 0, h->node);
+  total = 0;
+  if(h->leaders != MPI_COMM_NULL) {
+    mcnt[h->node_size] = 0;
+    for(i = 1; i < h->node_size; i++) mcnt[h->node_size + i] = mcnt[h->node_size + i - 1] + mcnt[i - 1];
+    total = mcnt[2 * h->node_size - 1] + mcnt[h->node_size - 1];
+    nodebuf = my_malloc(id, total ? (size_t) total : 1);
+  }
+  gather_bytes(sendbuf, bytes, nodebuf, mcnt, mcnt == NULL ? NULL : mcnt + h->node_size, 0, h->node);
+
+  /* The root's leader collects the nodes' packets */
+  if(id == root || id == root_leader) lcnt = my_malloc(id, 2 * h->nodes * sizeof(long long));
+  if(h->leaders != MPI_COMM_NULL) {
+    MPI_Gather(&total, 1, MPI_LONG_LONG, lcnt, 1, MPI_LONG_LONG, h->node_of[root], h->leaders);
+    if(id == root_leader) {
+      lcnt[h->nodes] = 0;
+      for(j = 1; j < h->nodes; j++) lcnt[h->nodes + j] = lcnt[h->nodes + j - 1] + lcnt[j - 1];
+      packed = my_malloc(id, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]));
+    }
+    gather_bytes(nodebuf, total, packed, lcnt, lcnt == NULL ? NULL : lcnt + h->nodes, h->node_of[root], h->leaders);
+  }
+  if(root != root_leader) {
+    if(id == root_leader) {
+      MPI_Send(lcnt, 2 * h->nodes, MPI_LONG_LONG, root, DATA_MSG, comm);
+      big_send(packed, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]), MPI_BYTE, root, DATA_MSG, comm);
+    } else if(id == root) {
+      MPI_Recv(lcnt, 2 * h->nodes, MPI_LONG_LONG, root_leader, DATA_MSG, comm, MPI_STATUS_IGNORE);
+      packed = my_malloc(id, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]));
+      big_recv(packed, (size_t) (lcnt[2 * h->nodes - 1] + lcnt[h->nodes - 1]), MPI_BYTE, root_leader, DATA_MSG, comm);
+    }
+  }
+
+  /* The root unpacks */
+  if(id == root)
+    for(j = 0; j < h->nodes; j++)
+      pack_node_blocks(h, p, j, cnt, disp, extent, recvbuf, packed + lcnt[h->nodes + j], 1);
+
+  my_free(lcnt);
+  my_free(mcnt);
+  my_free(nodebuf);
+  my_free(packed);
 }
 
 /*
@@ -105,60 +1137,294 @@ void terminate(
    fflush(stdout);
   }
   
-  MPI_Finalize();
+  my_finalize();
   exit(-1);
 }
 
+/* Weighted decomposition
+ *
+ * A process's share of an array is proportional to its
+ * weight: process 'id' owns the elements from
+ * n * W(id) / W(p), where W(i) is the sum of the weights of
+ * the ranks below i. The weights are cached on the
+ * communicator they were set on and apply only to
+ * decompositions over it: a communicator split or duplicated
+ * from it, even with the same size, splits evenly until it is
+ * given weights of its own. Set them before distributing data
+ */
+
+/*
+ * Elements per second this process sweeps through a
+ * multiply-add over a 4 MB array, over CALIBRATE_SECONDS.
+ * Processes sharing a core or a memory bus should run it
+ * together to see each other
+ */
+double calibrate_weight(int id)
+{
+  double *a;
+  double sum = 0.0, t;
+  long reps = 0;
+  int i;
+
+  a = my_malloc(id, CALIBRATE_ELEMS * sizeof(double));
+  for(i = 0; i < CALIBRATE_ELEMS; i++) a[i] = i & 7;
+  t = MPI_Wtime();
+  do {
+    for(i = 0; i < CALIBRATE_ELEMS; i++) sum += a[i] * 1.000001 + 0.5;
+    reps++;
+  } while(MPI_Wtime() - t < CALIBRATE_SECONDS);
+  t = MPI_Wtime() - t;
+  calibrate_sink = sum;
+  my_free(a);
+  return reps * (double) CALIBRATE_ELEMS / t;
+}
+
+/*
+ * Forget the cached xfer arrays, which depend on the
+ * decomposition
+ */
+void flush_xfer_arrays(void)
+{
+  xfer_entry *e;
+
+  while((e = xfer_cache) != NULL) {
+    xfer_cache = e->next;
+    my_free(e->count);
+    my_free(e->disp);
+    my_free(e);
+  }
+}
+
+/*
+ * Attribute delete function of the weights
+ */
+int free_block_weights(MPI_Comm comm, int keyval, void *attr, void *extra)
+{
+  my_free(attr);
+  flush_xfer_arrays();
+  return MPI_SUCCESS;
+}
+
+/*
+ * Share of the processes of 'comm' below each rank, from 0 to
+ * 1, or NULL when 'comm' splits evenly
+ */
+double *block_weights(MPI_Comm comm)
+{
+  double *prefix;
+  int found;
+
+  if(weights_keyval == MPI_KEYVAL_INVALID) return NULL;
+  MPI_Comm_get_attr(comm, weights_keyval, &prefix, &found);
+  return found ? prefix : NULL;
+}
+
+/*
+ * Weight this process's share of the decompositions over
+ * 'comm'. A weight of 0 or less is measured with
+ * 'calibrate_weight'.
+ * 
+ * All processes must invoke this function together
+ */
+void set_block_weights(
+  double weight,	/* IN - This process's weight */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  double *w;		/* Weights of all processes */
+  double *prefix;	/* Their prefix sums */
+  int i, id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  if(weight <= 0.0) {
+    MPI_Barrier(comm);
+    weight = calibrate_weight(id);
+  }
+  w = my_malloc(id, p * sizeof(double));
+  MPI_Allgather(&weight, 1, MPI_DOUBLE, w, 1, MPI_DOUBLE, comm);
+  prefix = my_malloc(id, (p + 1) * sizeof(double));
+  prefix[0] = 0.0;
+  for(i = 0; i < p; i++) prefix[i + 1] = prefix[i] + w[i];
+  for(i = 1; i < p; i++) prefix[i] /= prefix[p];
+  prefix[p] = 1.0;
+  my_free(w);
+  if(weights_keyval == MPI_KEYVAL_INVALID)
+    MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, free_block_weights, &weights_keyval, NULL);
+  MPI_Comm_set_attr(comm, weights_keyval, prefix);
+  flush_xfer_arrays();
+}
+
+/*
+ * Set the weights from HELPERS_WEIGHTS: "calibrate" measures
+ * them, a list "w0,w1,..." gives rank i the i-th weight
+ * (repeating the list when it is shorter). Unset, the split
+ * stays even.
+ * 
+ * All processes must invoke this function together
+ */
+void init_block_weights(MPI_Comm comm)
+{
+  char *env, *next;
+  double weight = 0.0;
+  int i, id;
+
+  if((env = getenv("HELPERS_WEIGHTS")) == NULL || !*env) return;
+  MPI_Comm_rank(comm, &id);
+  if(strcmp(env, "calibrate")) {
+    for(i = 0, next = env; i <= id; i++) {
+      weight = strtod(next, &next);
+      if(*next == ',') next++;
+      else if(i < id) next = env;
+    }
+    if(weight <= 0.0) weight = 1.0;
+  }
+  set_block_weights(weight, comm);
+}
+
+/*
+ * First, or lowest, index controlled by process 'id' of
+ * 'comm'
+ */
+long long block_low(int id, int p, long long n, MPI_Comm comm)
+{
+  double *prefix = block_weights(comm);
+
+  if(prefix == NULL) return BLOCK_LOW(id, p, n);
+  if(id >= p) return n;
+  return (long long) (n * prefix[id]);
+}
+
+/*
+ * Last, or highest, index controlled by process 'id'
+ */
+long long block_high(int id, int p, long long n, MPI_Comm comm)
+{
+  return block_low(id + 1, p, n, comm) - 1;
+}
+
+/*
+ * Number of elements controlled by process 'id'
+ */
+long long block_size(int id, int p, long long n, MPI_Comm comm)
+{
+  return block_low(id + 1, p, n, comm) - block_low(id, p, n, comm);
+}
+
+/*
+ * Rank of the process controlling element 'index'
+ */
+int block_owner(long long index, int p, long long n, MPI_Comm comm)
+{
+  double *prefix = block_weights(comm);
+  int lo = 0, hi = p - 1, mid;
+
+  if(prefix == NULL) return BLOCK_OWNER(index, p, n);
+  while(lo < hi) {	/* Last rank starting at or before 'index' */
+    mid = (lo + hi + 1) / 2;
+    if((long long) (n * prefix[mid]) <= index) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
 /* Data distribution functions */
 
+/*
+ * Cached count and displacement arrays for these
+ * parameters, or NULL
+ */
+xfer_entry *find_xfer_arrays(int uniform, int id, int p, int n, double *weights)
+{
+  xfer_entry *e;
+
+  for(e = xfer_cache; e != NULL; e = e->next)
+    if(e->uniform == uniform && e->id == id && e->p == p && e->n == n && e->weights == weights) return e;
+  return NULL;
+}
+
+/*
+ * Allocate count and displacement arrays and keep them in
+ * the cache
+ */
+xfer_entry *new_xfer_arrays(int uniform, int id, int p, int n, double *weights)
+{
+  xfer_entry *e;
+
+  e = my_malloc(id, sizeof(xfer_entry));
+  e->uniform = uniform;
+  e->id = id;
+  e->p = p;
+  e->n = n;
+  e->weights = weights;
+  e->count = my_malloc(id, p * sizeof(int));
+  e->disp = my_malloc(id, p * sizeof(int));
+  e->next = xfer_cache;
+  xfer_cache = e;
+  return e;
+}
+
 /*
  * This function creates the count and displacement arrays
  * needed by scatter and gather functions, when the number
  * of elements send/received to/from other processes
  * varies.
+ *
+ * The arrays are cached and shared by later calls with the
+ * same arguments; callers must not modify or free them
  */
 void create_mixed_xfer_arrays(
   int id,	/* IN - Process rank */
   int p,	/* IN - Number of processes */
   int n,	/* IN - Total number of elements */
+  MPI_Comm comm,	/* IN - Communicator */
   int **count,	/* OUT - Array of counts */
   int **disp)	/* OUT - Array of displacements */
 {
+  xfer_entry *e;
   int i;
   
-  *count = my_malloc(id, p * sizeof(int));
-  *disp = my_malloc(id, p * sizeof(int));
-  (*count)[0] = BLOCK_SIZE(0, p, n);
-  (*disp)[0] = 0;
-  for(i = 1; i < p; i++) {
-    (*disp)[i] = (*disp)[i - 1] + (*count)[i - 1];
-    (*count)[i] = BLOCK_SIZE(i, p, n);
+  if((e = find_xfer_arrays(0, id, p, n, block_weights(comm))) == NULL) {
+    e = new_xfer_arrays(0, id, p, n, block_weights(comm));
+    e->count[0] = block_size(0, p, n, comm);
+    e->disp[0] = 0;
+    for(i = 1; i < p; i++) {
+      e->disp[i] = e->disp[i - 1] + e->count[i - 1];
+      e->count[i] = block_size(i, p, n, comm);
+    }
   }
+  *count = e->count;
+  *disp = e->disp;
 }
 
 /*
  * This function creates the count and displacement arrays
  * needed in an all-to-all exchange, when a process gets
  * the same number of elements from every other process.
+ *
+ * Cached like 'create_mixed_xfer_arrays'
  */
 void create_uniform_xfer_arrays(
   int id,	/* IN - Process rank */
   int p,	/* IN - Number of processes */
   int n,	/* IN - Number of elements */
+  MPI_Comm comm,	/* IN - Communicator */
   int **count,	/* OUT - Array of counts */
   int **disp)	/* OUT - Array of displacements */
 {
+  xfer_entry *e;
   int i;
   
-  *count = my_malloc(id, p * sizeof(int));
-  *disp = my_malloc(id, p * sizeof(int));
-  
-  (*count)[0] = BLOCK_SIZE(id, p, n);
-  (*disp)[0] = 0;
-  for(i = 1; i < p; i++) {
-   (*disp)[i] = (*disp)[i - 1] + (*count)[i - 1];
-   (*count)[i] = BLOCK_SIZE(id, p, n);
+  if((e = find_xfer_arrays(1, id, p, n, block_weights(comm))) == NULL) {
+    e = new_xfer_arrays(1, id, p, n, block_weights(comm));
+    e->count[0] = block_size(id, p, n, comm);
+    e->disp[0] = 0;
+    for(i = 1; i < p; i++) {
+     e->disp[i] = e->disp[i - 1] + e->count[i - 1];
+     e->count[i] = block_size(id, p, n, comm);
+    }
   }
+  *count = e->count;
+  *disp = e->disp;
 }
 
 /*
@@ -180,11 +1446,179 @@ void replicate_block_vector(
     
     MPI_Comm_size(comm, &p);
     MPI_Comm_rank(comm, &id);
-    create_mixed_xfer_arrays(id, p, n, &cnt, &disp);
-    MPI_Allgatherv(ablock, cnt[id], dtype, arep, cnt, disp, dtype, comm);
-    
-    free(cnt);
-    free(disp);
+    create_mixed_xfer_arrays(id, p, n, comm, &cnt, &disp);
+    hier_allgatherv(ablock, cnt[id], dtype, arep, cnt, disp, comm);
+}
+
+/*
+ * Rows and columns held by process 'rank' in 'layout': the
+ * block [*r0, *r0 + *rows) x [*c0, *c0 + *cols), stored row
+ * by row. A checkerboard splits the rows over the first
+ * dimension of the grid of 'comm' and the columns over the
+ * second, as 'print_checkboard_matrix' does
+ */
+void layout_block(
+  int layout,		/* IN - LAYOUT_... */
+  int rank,		/* IN - Process */
+  int m,		/* IN - Matrix rows */
+  int n,		/* IN - Matrix cols */
+  MPI_Comm comm,	/* IN - Communicator */
+  long long *r0,	/* OUT - First row */
+  int *rows,		/* OUT - Rows */
+  long long *c0,	/* OUT - First column */
+  int *cols)		/* OUT - Columns */
+{
+  int dims[2], periods[2], coords[2], p;
+
+  MPI_Comm_size(comm, &p);
+  *r0 = *c0 = 0;
+  *rows = m;
+  *cols = n;
+  if(layout == LAYOUT_ROWS) {
+    *r0 = block_low(rank, p, m, comm);
+    *rows = (int) block_size(rank, p, m, comm);
+  } else if(layout == LAYOUT_COLS) {
+    *c0 = block_low(rank, p, n, comm);
+    *cols = (int) block_size(rank, p, n, comm);
+  } else {
+    MPI_Cart_get(comm, 2, dims, periods, coords);
+    MPI_Cart_coords(comm, rank, 2, coords);
+    *r0 = BLOCK_LOW(coords[0], dims[0], m);
+    *rows = (int) BLOCK_SIZE(coords[0], dims[0], m);
+    *c0 = BLOCK_LOW(coords[1], dims[1], n);
+    *cols = (int) BLOCK_SIZE(coords[1], dims[1], n);
+  }
+}
+
+/*
+ * Type of the 'h' x 'w' block at ('i', 'j') of a row-major
+ * array of 'cols' columns, read column by column: the order
+ * in which its transpose is stored
+ */
+MPI_Datatype transposed_subarray(
+  int cols,		/* IN - Array cols */
+  long long i,		/* IN - Block's first row */
+  long long j,		/* IN - Block's first column */
+  int h,		/* IN - Block rows */
+  int w,		/* IN - Block cols */
+  MPI_Datatype dtype)	/* IN - Element type */
+{
+  MPI_Datatype column, step, walk, t;
+  MPI_Aint lb, extent, start;
+  int one = 1;
+
+  MPI_Type_get_extent(dtype, &lb, &extent);
+  MPI_Type_vector(h, 1, cols, dtype, &column);
+  MPI_Type_create_resized(column, 0, extent, &step);
+  MPI_Type_contiguous(w, step, &walk);
+  start = (MPI_Aint) (i * cols + j) * extent;
+  MPI_Type_create_hindexed(1, &one, &start, walk, &t);
+  MPI_Type_commit(&t);
+  MPI_Type_free(&column);
+  MPI_Type_free(&step);
+  MPI_Type_free(&walk);
+  return t;
+}
+
+/*
+ * Move an 'm' x 'n' matrix held in layout 'from' into layout
+ * 'to', or its transpose if 'transpose' (an 'n' x 'm' matrix
+ * laid out as 'to'). Each pair of processes exchanges the
+ * overlap of their old and new blocks in one MPI_Alltoallw,
+ * sent and received through subarray types, so nothing is
+ * packed on the way. The new block is allocated as by the
+ * readers. Checkerboard layouts need a Cartesian 'comm'.
+ *
+ * All processes must invoke this function together
+ */
+void redistribute_matrix(
+  void *storage,	/* IN - Elements in layout 'from' */
+  int from,		/* IN - LAYOUT_... held */
+  int m,		/* IN - Matrix rows */
+  int n,		/* IN - Matrix cols */
+  int to,		/* IN - LAYOUT_... wanted */
+  int transpose,	/* IN - Deliver the transpose */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void ***subs,		/* OUT - Row pointers of the new block */
+  void **new_storage,	/* OUT - Its elements */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  MPI_Datatype *stype, *rtype;	/* Exchange types, by process */
+  int *scnt, *sdisp, *rcnt, *rdisp;
+  long long r0, c0, t0, u0;	/* Block corners, in 'from' coordinates */
+  long long i0, i1, j0, j1;	/* Overlap */
+  int rows, cols, trows, tcols;	/* Block sizes */
+  int mr0, mrows, mc0, mcols;	/* New block, in 'to' coordinates */
+  long long nr0, nc0;
+  int topo, id, p, k;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  MPI_Topo_test(comm, &topo);
+  if((from == LAYOUT_CHECKERBOARD || to == LAYOUT_CHECKERBOARD) && topo != MPI_CART)
+    terminate(id, "Checkerboard layout needs a Cartesian communicator");
+
+  layout_block(from, id, m, n, comm, &r0, &rows, &c0, &cols);
+  if(transpose) layout_block(to, id, n, m, comm, &nr0, &mrows, &nc0, &mcols);
+  else layout_block(to, id, m, n, comm, &nr0, &mrows, &nc0, &mcols);
+  mr0 = (int) nr0;
+  mc0 = (int) nc0;
+  *new_storage = alloc_matrix_block(id, mrows, mcols, get_size(dtype), subs);
+
+  stype = (MPI_Datatype *) my_malloc(id, 2 * p * sizeof(MPI_Datatype));
+  rtype = stype + p;
+  scnt = (int *) my_malloc(id, 4 * p * sizeof(int));
+  sdisp = scnt + p;
+  rcnt = sdisp + p;
+  rdisp = rcnt + p;
+  for(k = 0; k < p; k++) {
+    sdisp[k] = rdisp[k] = 0;
+
+    /* What process k gets from this process */
+    if(transpose) layout_block(to, k, n, m, comm, &u0, &tcols, &t0, &trows);
+    else layout_block(to, k, m, n, comm, &t0, &trows, &u0, &tcols);
+    i0 = MAX(r0, t0);
+    i1 = MIN(r0 + rows, t0 + trows);
+    j0 = MAX(c0, u0);
+    j1 = MIN(c0 + cols, u0 + tcols);
+    scnt[k] = i1 > i0 && j1 > j0;
+    stype[k] = dtype;
+    if(scnt[k] && transpose)
+      stype[k] = transposed_subarray(cols, i0 - r0, j0 - c0, (int) (i1 - i0), (int) (j1 - j0), dtype);
+    else if(scnt[k]) {
+      int sizes[2] = { rows, cols };
+      int sub[2] = { (int) (i1 - i0), (int) (j1 - j0) };
+      int starts[2] = { (int) (i0 - r0), (int) (j0 - c0) };
+      MPI_Type_create_subarray(2, sizes, sub, starts, MPI_ORDER_C, dtype, &stype[k]);
+      MPI_Type_commit(&stype[k]);
+    }
+
+    /* What this process gets from process k */
+    if(transpose) layout_block(from, k, m, n, comm, &u0, &tcols, &t0, &trows);
+    else layout_block(from, k, m, n, comm, &t0, &trows, &u0, &tcols);
+    i0 = MAX(nr0, t0);
+    i1 = MIN(nr0 + mrows, t0 + trows);
+    j0 = MAX(nc0, u0);
+    j1 = MIN(nc0 + mcols, u0 + tcols);
+    rcnt[k] = i1 > i0 && j1 > j0;
+    rtype[k] = dtype;
+    if(rcnt[k]) {
+      int sizes[2] = { mrows, mcols };
+      int sub[2] = { (int) (i1 - i0), (int) (j1 - j0) };
+      int starts[2] = { (int) (i0 - mr0), (int) (j0 - mc0) };
+      MPI_Type_create_subarray(2, sizes, sub, starts, MPI_ORDER_C, dtype, &rtype[k]);
+      MPI_Type_commit(&rtype[k]);
+    }
+  }
+
+  MPI_Alltoallw(storage, scnt, sdisp, stype, *new_storage, rcnt, rdisp, rtype, comm);
+
+  for(k = 0; k < p; k++) {
+    if(scnt[k]) MPI_Type_free(&stype[k]);
+    if(rcnt[k]) MPI_Type_free(&rtype[k]);
+  }
+  my_free(scnt);
+  my_free(stype);
 }
 
 /* INPUT functions */
@@ -216,16 +1650,350 @@ void read_replicated_vector(
     if(infileptr == NULL) *n = 0;
     else fread(n, sizeof(int), 1, infileptr);
   }
-  MPI_Bcast(n, 1, MPI_INT, p - 1, MPI_COMM_WORLD);
+  MPI_Bcast(n, 1, MPI_INT, p - 1, comm);
   if(! *n) terminate(id, "Cannot open vector file");
   
-  *v = my_malloc(id, *n * datum_size);
+  *v = my_malloc(id, (size_t) *n * datum_size);
   
   if(id == (p - 1)) {
    fread(*v, datum_size, *n, infileptr) ;
    fclose(infileptr);
   }
-  MPI_Bcast(*v, *n, dtype, p - 1, MPI_COMM_WORLD);
+  hier_bcast(*v, *n, dtype, p - 1, comm);
+}
+
+/* Node-shared replication
+ *
+ * A replicated vector can be kept once per node instead of
+ * once per process: the processes of a node map the same
+ * MPI-3 shared memory window, and only one process per
+ * node, the leader, takes part in the inter-node transfer.
+ * The vector is released with 'free_shared_segment'
+ */
+
+/*
+ * Allocate 'bytes' bytes once per node of 'comm'. Every
+ * process gets the address of its node's copy
+ */
+void *alloc_shared_segment(
+  size_t bytes,		/* IN - Bytes to allocate */
+  MPI_Comm comm,	/* IN - Communicator */
+  shared_segment *sh)	/* OUT - Window and communicators */
+{
+  void *base;		/* Node's copy */
+  int disp_unit;
+  hier_info *h = get_hier_info(comm);
+  MPI_Aint size;
+
+  sh->node = h->node;
+  sh->leaders = h->leaders;
+  MPI_Win_allocate_shared(h->leaders == MPI_COMM_NULL ? 0 : (MPI_Aint) (bytes ? bytes : 1), 1,
+			  MPI_INFO_NULL, sh->node, &base, &sh->win);
+  MPI_Win_shared_query(sh->win, 0, &size, &disp_unit, &base);
+  return base;
+}
+
+void free_shared_segment(shared_segment *sh)
+{
+  MPI_Win_free(&sh->win);
+}
+
+/*
+ * Like 'read_replicated_vector', but the vector is stored
+ * once per node. Process p - 1 reads the file into its
+ * node's copy and the node leaders broadcast it
+ */
+void read_shared_vector(
+  char *s,		/* IN - File name */
+  void **v,		/* OUT - Vector */
+  MPI_Datatype dtype,	/* IN - Vector type */
+  int *n,		/* OUT - Vector length */
+  MPI_Comm comm,	/* IN - Communicator */
+  shared_segment *sh)	/* OUT - Where the vector lives */
+{
+  int datum_size;	/* Bytes per vector element */
+  int id;		/* Process rank */
+  FILE *infileptr = NULL;	/* Input file pointer */
+  int p;		/* Number of processes */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  datum_size = get_size(dtype);
+  if(id == (p - 1)) {
+    infileptr = fopen(s, "r");
+    if(infileptr == NULL) *n = 0;
+    else fread(n, sizeof(int), 1, infileptr);
+  }
+  MPI_Bcast(n, 1, MPI_INT, p - 1, comm);
+  if(! *n) terminate(id, "Cannot open vector file");
+
+  *v = alloc_shared_segment((size_t) *n * datum_size, comm, sh);
+  MPI_Win_fence(0, sh->win);
+  if(id == (p - 1)) {
+    fread(*v, datum_size, *n, infileptr);
+    fclose(infileptr);
+  }
+  MPI_Win_fence(0, sh->win);
+  if(sh->leaders != MPI_COMM_NULL && get_hier_info(comm)->nodes > 1)
+    big_bcast(*v, *n, dtype, get_hier_info(comm)->node_of[p - 1], sh->leaders);
+  MPI_Win_fence(0, sh->win);
+}
+
+/*
+ * Like 'replicate_block_vector', but the replicated vector
+ * is allocated here and stored once per node. Each process
+ * copies its block into its node's copy; the leaders then
+ * exchange whole nodes' blocks
+ */
+void replicate_block_vector_shared(
+  void *ablock,		/* IN - Block-distributed vector */
+  int n,		/* IN - Elements of vector */
+  void **arep,		/* OUT - Replicated vector */
+  MPI_Datatype dtype,	/* IN - Element type */
+  MPI_Comm comm,	/* IN - Communicator */
+  shared_segment *sh)	/* OUT - Where the vector lives */
+{
+  int *cnt;		/* Elements of each process */
+  int datum_size;	/* Bytes per element */
+  int *disp;		/* Their displacements */
+  int id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  datum_size = get_size(dtype);
+  *arep = alloc_shared_segment((size_t) n * datum_size, comm, sh);
+  create_mixed_xfer_arrays(id, p, n, comm, &cnt, &disp);
+
+  MPI_Win_fence(0, sh->win);
+  memcpy((char *) *arep + (size_t) disp[id] * datum_size, ablock, (size_t) cnt[id] * datum_size);
+  MPI_Win_fence(0, sh->win);
+  leaders_allgatherv(get_hier_info(comm), *arep, cnt, disp, dtype, p);
+  MPI_Win_fence(0, sh->win);
+}
+
+/*
+ * Process p - 1 reads the 'n' units of 'unit' elements that
+ * follow in file 'f' and delivers them block distributed:
+ * each process gets its units in 'local'. On a node holding
+ * consecutive ranks, the blocks of neighbouring processes
+ * are read together while they fit in READ_CHUNK bytes,
+ * sent to the node's leader as one message and scattered on
+ * the node. A block on its own goes straight to its process,
+ * READ_CHUNK bytes at a time. The reader and the leaders
+ * never hold more than READ_CHUNK bytes
+ */
+void read_scatter_blocks(
+  FILE *f,		/* IN - File (process p - 1) */
+  int n,		/* IN - Units */
+  int unit,		/* IN - Elements per unit */
+  MPI_Datatype dtype,	/* IN - Element type */
+  void *local,		/* OUT - This process's units */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  char *buffer = NULL;	/* Units in transit */
+  size_t bytes;		/* Of a group's blocks */
+  size_t chunk;		/* Elements in READ_CHUNK bytes */
+  int datum_size;	/* Bytes per element */
+  int first, last;	/* A group of processes, [first, last) */
+  hier_info *h = get_hier_info(comm);
+  int i, j, g, id, p;
+  size_t k, len, total;	/* Pieces of a block */
+  int *ucnt, *udisp;	/* Units of the node's processes */
+  MPI_Datatype unit_type;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  datum_size = get_size(dtype);
+  chunk = MAX(1, READ_CHUNK / datum_size);
+  MPI_Type_contiguous(unit, dtype, &unit_type);
+  MPI_Type_commit(&unit_type);
+  ucnt = my_malloc(id, 2 * h->node_size * sizeof(int));
+  udisp = ucnt + h->node_size;
+
+  for(first = 0; first < p; first = last) {
+    bytes = (size_t) block_size(first, p, n, comm) * unit * datum_size;
+    for(last = first + 1; h->contiguous && last < p && h->node_of[last] == h->node_of[first] &&
+	  bytes + (size_t) block_size(last, p, n, comm) * unit * datum_size <= READ_CHUNK; last++)
+      bytes += (size_t) block_size(last, p, n, comm) * unit * datum_size;
+
+    /* One block: straight to its process, in pieces */
+    if(last == first + 1) {
+      total = (size_t) block_size(first, p, n, comm) * unit;
+      if(id == (p - 1) && first == id) fread(local, datum_size, total, f);
+      else if(id == (p - 1))
+	for(buffer = scratch_buffer(id, SCRATCH_BLOCK, chunk * datum_size), k = 0; k < total; k += len) {
+	  len = MIN(chunk, total - k);
+	  fread(buffer, datum_size, len, f);
+	  big_send(buffer, len, dtype, first, DATA_MSG, comm);
+	}
+      else if(id == first)
+	for(k = 0; k < total; k += len) {
+	  len = MIN(chunk, total - k);
+	  big_recv((char *) local + k * datum_size, len, dtype, p - 1, DATA_MSG, comm);
+	}
+      continue;
+    }
+
+    /* Several: through the leader of their node */
+    j = h->node_of[first];
+    if(id == (p - 1) || id == h->leader[j]) buffer = scratch_buffer(id, SCRATCH_BLOCK, chunk * datum_size);
+    if(id == (p - 1)) {
+      fread(buffer, 1, bytes, f);
+      if(h->leader[j] != id)
+	big_send(buffer, bytes / datum_size, dtype, h->leader[j], DATA_MSG, comm);
+    }
+    if(h->my_node == j) {
+      if(id == h->leader[j]) {
+	if(id != (p - 1))
+	  big_recv(buffer, bytes / datum_size, dtype, p - 1, DATA_MSG, comm);
+	for(i = 0; i < h->node_size; i++) {
+	  g = h->leader[j] + i;
+	  ucnt[i] = g >= first && g < last ? block_size(g, p, n, comm) : 0;
+	  udisp[i] = g >= first && g < last ? block_low(g, p, n, comm) - block_low(first, p, n, comm) : 0;
+	}
+      }
+      MPI_Scatterv(buffer, ucnt, udisp, unit_type, local, id >= first && id < last ? block_size(id, p, n, comm) : 0,
+		   unit_type, 0, h->node);
+    }
+  }
+  my_free(ucnt);
+  MPI_Type_free(&unit_type);
+  release_scratch(SCRATCH_BLOCK);
+}
+
+/*
+ * Element type of a tiled file for 'dtype'; 0 if it has none
+ */
+int tiled_type(MPI_Datatype dtype)
+{
+  if(dtype == MPI_CHAR) return TILED_CHAR;
+  if(dtype == MPI_INT) return TILED_INT;
+  if(dtype == MPI_FLOAT) return TILED_FLOAT;
+  if(dtype == MPI_DOUBLE) return TILED_DOUBLE;
+  return 0;
+}
+
+/*
+ * Process p - 1 reads the start of file 's'. Returns on
+ * every process 0 for a legacy (or missing) file, else 1,
+ * or 2 when the file was written in the other byte order;
+ * the header, in this machine's order, is then in 'h'
+ */
+int read_tiled_info(
+  char *s,		/* IN - File name */
+  tiled_header *h,	/* OUT - Header of a tiled file */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  FILE *infileptr;
+  int kind = 0, id, p;
+
+  MPI_Comm_size(comm, &p);
+  MPI_Comm_rank(comm, &id);
+  if(id == (p - 1) && (infileptr = fopen(s, "rb")) != NULL) {
+    if(fread(h, sizeof(tiled_header), 1, infileptr) == 1) kind = tiled_check_header(h);
+    fclose(infileptr);
+  }
+  MPI_Bcast(&kind, 1, MPI_INT, p - 1, comm);
+  if(kind) MPI_Bcast(h, sizeof(tiled_header), MPI_BYTE, p - 1, comm);
+  return kind;
+}
+
+/*
+ * Read the rows [r0, r0 + rows) and columns [c0, c0 + cols)
+ * of the matrix in the tiled file 'f' into 'out', row by
+ * row, from the tiles they overlap. Every tile's CRC is
+ * checked before it is decoded
+ */
+void read_tiled_block(
+  MPI_File f,		/* IN - Open tiled file */
+  tiled_header *h,	/* IN - Its header */
+  tiled_entry *index,	/* IN - Its index */
+  int swapped,		/* IN - Written in the other byte order */
+  long long r0,		/* IN - First row */
+  int rows,		/* IN - Rows */
+  long long c0,		/* IN - First column */
+  int cols,		/* IN - Columns */
+  void *out,		/* OUT - The block */
+  int id)		/* IN - Process rank */
+{
+  size_t tile_elems = (size_t) h->tile_rows * h->tile_cols;
+  size_t bound = compress_bound(tile_elems, h->elem_size);
+  size_t es = h->elem_size;
+  unsigned char *payload, *codec;
+  char *tile;
+  tiled_entry *e;
+  long long down, across, ti, tj, i, i0, i1, j0, j1;
+  int th, tw;
+
+  if(rows <= 0 || cols <= 0) return;
+  payload = scratch_buffer(id, SCRATCH_PACKED, bound);
+  codec = scratch_buffer(id, SCRATCH_CODEC, tile_elems * es);
+  tile = scratch_buffer(id, SCRATCH_BLOCK, tile_elems * es);
+  tiled_grid(h, &down, &across);
+  for(ti = r0 / h->tile_rows; ti <= (r0 + rows - 1) / h->tile_rows; ti++)
+    for(tj = c0 / h->tile_cols; tj <= (c0 + cols - 1) / h->tile_cols; tj++) {
+      e = &index[ti * across + tj];
+      tiled_shape(h, ti, tj, &th, &tw);
+      if(e->bytes < 0 || (size_t) e->bytes > bound) e->bytes = 0;
+      MPI_File_read_at(f, e->offset, payload, (int) e->bytes, MPI_BYTE, MPI_STATUS_IGNORE);
+      if(!e->bytes || crc32_update(0, payload, e->bytes) != e->crc) {
+	printf("Checksum error in tile (%lld, %lld)\n", ti, tj);
+	fflush(stdout);
+	MPI_Abort(MPI_COMM_WORLD, OPEN_FILE_ERROR);
+      }
+      decode_tile(payload, e->bytes, (size_t) th * tw, h, swapped, tile, codec);
+
+      /* Copy the part of the tile inside the block */
+      i0 = MAX(r0, ti * h->tile_rows);
+      i1 = MIN(r0 + rows, ti * h->tile_rows + th);
+      j0 = MAX(c0, tj * h->tile_cols);
+      j1 = MIN(c0 + cols, tj * h->tile_cols + tw);
+      for(i = i0; i < i1; i++)
+	memcpy((char *) out + ((i - r0) * cols + (j0 - c0)) * es,
+	       tile + ((i - ti * h->tile_rows) * tw + (j0 - tj * h->tile_cols)) * es, (j1 - j0) * es);
+    }
+}
+
+/*
+ * Every process reads its block, in 'layout', of the
+ * matrix in the tiled file 's'
+ */
+void read_tiled_matrix(
+  char *s,		/* IN - File name */
+  int layout,		/* IN - LAYOUT_... */
+  void ***subs,		/* OUT - 2D submatrix indices */
+  void **storage,	/* OUT - Submatrix stored here */
+  MPI_Datatype dtype,	/* IN - Matrix element type */
+  int *m,		/* OUT - Matrix rows */
+  int *n,		/* OUT - Matrix cols */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  tiled_header h;
+  tiled_entry *index;
+  MPI_File f;
+  long long down, across, r0, c0;
+  int kind, rows, cols, id;
+
+  MPI_Comm_rank(comm, &id);
+  if(!(kind = read_tiled_info(s, &h, comm))) terminate(id, "Not a tiled matrix file");
+  if(h.version != TILED_VERSION || h.type != tiled_type(dtype) || h.elem_size != get_size(dtype))
+    terminate(id, "Tiled file holds another version or element type");
+  if(h.m > INT_MAX || h.n > INT_MAX || h.tile_rows <= 0 || h.tile_cols <= 0)
+    terminate(id, "Tiled file has unsupported dimensions");
+  *m = (int) h.m;
+  *n = (int) h.n;
+  tiled_grid(&h, &down, &across);
+  index = my_malloc(id, down * across * sizeof(tiled_entry) + 1);
+  MPI_File_open(comm, s, MPI_MODE_RDONLY, MPI_INFO_NULL, &f);
+  MPI_File_read_at_all(f, h.index, index, (int) (down * across * sizeof(tiled_entry)), MPI_BYTE,
+		       MPI_STATUS_IGNORE);
+  if(kind == 2) tiled_swap_index(index, down * across);
+
+  layout_block(layout, id, *m, *n, comm, &r0, &rows, &c0, &cols);
+  *storage = alloc_matrix_block(id, rows, cols, get_size(dtype), subs);
+  read_tiled_block(f, &h, index, kind == 2, r0, rows, c0, cols, *storage, id);
+  MPI_File_close(&f);
+  my_free(index);
 }
 
 /*
@@ -243,20 +2011,21 @@ void read_row_striped_matrix(
   MPI_Comm comm)	/* IN - Communicator */
 {
     int datum_size;	/* Size of matrix element */
-    int i;
     int id;		/* Process rank */
     FILE *infileptr;	/* Input file pointer */
     int local_rows;	/* Rows on this proc */
-    void **lptr;	/* Pointer into 'subs' */
     int p;		/* Number of processes */
-    void *rtptr;	/* Pointer into 'storage' */
-    MPI_Status status;	/* Result of receive */
-    int x;		/* Result of read */
+    tiled_header h;	/* Header of a tiled file */
     
     MPI_Comm_size(comm, &p);
     MPI_Comm_rank(comm, &id);
     datum_size = get_size(dtype);
     
+    if(read_tiled_info(s, &h, comm)) {
+      read_tiled_matrix(s, LAYOUT_ROWS, subs, storage, dtype, m, n, comm);
+      return;
+    }
+    
     /* Process p - 1 opens file, reads size of matrix,
      * and broadcasts matrix dimensions to other procs
      */
@@ -279,38 +2048,126 @@ void read_row_striped_matrix(
     
     MPI_Bcast(n, 1, MPI_INT, p - 1, comm);
     
-    local_rows = BLOCK_SIZE(id, p, *m);
+    local_rows = block_size(id, p, *m, comm);
     
     /* Dynamically allocate matrix
      * Allow double subscripting through 'a'
      */
-    *storage = (void *)my_malloc(id, local_rows * *n * datum_size);
-    *subs = (void **)my_malloc(id, local_rows * PTR_SIZE);
-    
-    lptr = (void *) &(*subs[0]);
-    rtptr = (void *) *storage;
-    for(i = 0; i < local_rows; i++) {
-     *(lptr++) = (void *)rtptr;
-     rtptr += *n * datum_size;
-    }
+    *storage = alloc_matrix_block(id, local_rows, *n, datum_size, subs);
     
     /* Process p - 1 reads blocks of rows from file
-     * and sends each block to the correct destination
-     * process. The last block it keeps
+     * and delivers them, a few blocks at a time
      */
-    if(id == (p - 1)) {
-     for(i = 0; i < p - 1; i++)  {
-       x = fread(*storage, datum_size,
-	 BLOCK_SIZE(i, p, *m) * *n, infileptr);
-       
-       MPI_Send(*storage, BLOCK_SIZE(i, p, *m) * *n, dtype,
-		i, DATA_MSG, comm);
-     }
-     x = fread(*storage, datum_size, local_rows * *n, infileptr);
-     fclose(infileptr);
-    } else
-      MPI_Recv(*storage, local_rows * *n, dtype, p - 1,
-	DATA_MSG, comm, &status);
+    read_scatter_blocks(infileptr, *m, *n, dtype, *storage, comm);
+    if(id == (p - 1)) fclose(infileptr);
+}
+
+/*
+ * Process p - 1 reads the dimensions of the matrix in file
+ * 's' and broadcasts them
+ */
+void read_matrix_dims(
+  char *s,		/* IN - File name */
+  int *m,		/* OUT - Matrix rows */
+  int *n,		/* OUT - Matrix cols */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  FILE *infileptr;
+  tiled_header h;
+  int dims[2] = { 0, 0 };
+  int id, p;
+
+  MPI_Comm_size(comm, &p);
+  MPI_Comm_rank(comm, &id);
+  if(read_tiled_info(s, &h, comm)) {
+    *m = (int) h.m;
+    *n = (int) h.n;
+    return;
+  }
+  if(id == (p - 1)) {
+    infileptr = fopen(s, "r");
+    if(infileptr != NULL) {
+      if(fread(dims, sizeof(int), 2, infileptr) != 2) dims[0] = 0;
+      fclose(infileptr);
+    }
+  }
+  MPI_Bcast(dims, 2, MPI_INT, p - 1, comm);
+  if(!dims[0]) MPI_Abort(comm, OPEN_FILE_ERROR);
+  *m = dims[0];
+  *n = dims[1];
+}
+
+/*
+ * Every process reads its block of rows of the 'm' x 'n'
+ * matrix in file 's' (laid out as for
+ * 'read_row_striped_matrix') in chunks of at most 'chunk_bytes', double buffered: while
+ * 'consume' works on one chunk the next one is being read
+ * with MPI_File_iread_at. With 'consume' NULL the rows are
+ * only read, which measures the read rate alone. Memory use
+ * is two chunks, whatever the size of the matrix
+ */
+void stream_row_striped_matrix(
+  char *s,		/* IN - File name */
+  MPI_Datatype dtype,	/* IN - Matrix element type */
+  size_t chunk_bytes,	/* IN - Largest read */
+  row_consumer consume,	/* IN - Work on each chunk, or NULL */
+  void *arg,		/* IN - Passed to 'consume' */
+  int m,		/* IN - Matrix rows */
+  int n,		/* IN - Matrix cols */
+  stream_stats *st,	/* OUT - Bytes and times */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  MPI_File f;
+  MPI_Request req;
+  MPI_Offset row_bytes;	/* Bytes per row */
+  void *buffer[2];	/* Chunk in use, chunk being read */
+  int datum_size;	/* Size of matrix element */
+  int per;		/* Rows per chunk */
+  int cur, count, id, p;
+  long long lo, rows, done;
+  double t;
+  tiled_header h;	/* Header of a tiled file */
+
+  MPI_Comm_size(comm, &p);
+  MPI_Comm_rank(comm, &id);
+  if(read_tiled_info(s, &h, comm))
+    terminate(id, "Streaming reads legacy matrix files; convert with matrix_convert");
+  datum_size = get_size(dtype);
+  st->bytes = 0;
+  st->wait = 0.0;
+  st->seconds = -MPI_Wtime();
+
+  if(MPI_File_open(comm, s, MPI_MODE_RDONLY, MPI_INFO_NULL, &f) != MPI_SUCCESS) {
+    if(!id) printf("Cannot open %s\n", s);
+    MPI_Abort(comm, OPEN_FILE_ERROR);
+  }
+  row_bytes = (MPI_Offset) n * datum_size;
+  lo = block_low(id, p, m, comm);
+  rows = block_size(id, p, m, comm);
+  per = (int) MAX(1, MIN(chunk_bytes / (size_t) row_bytes, (size_t) rows));
+  buffer[0] = my_malloc(id, 2 * (size_t) per * row_bytes);
+  buffer[1] = (char *) buffer[0] + (size_t) per * row_bytes;
+
+  cur = 0;
+  if(rows > 0)
+    MPI_File_iread_at(f, 2 * sizeof(int) + lo * row_bytes, buffer[0], (int) MIN(per, rows) * n, dtype, &req);
+  for(done = 0; done < rows; done += count, cur ^= 1) {
+    count = (int) MIN(per, rows - done);
+    t = MPI_Wtime();
+    MPI_Wait(&req, MPI_STATUS_IGNORE);
+    st->wait += MPI_Wtime() - t;
+    st->bytes += count * row_bytes;
+
+    /* Start on the next chunk, then use this one */
+    if(done + count < rows)
+      MPI_File_iread_at(f, 2 * sizeof(int) + (lo + done + count) * row_bytes, buffer[cur ^ 1],
+			(int) MIN(per, rows - done - count) * n, dtype, &req);
+    if(consume != NULL) consume(buffer[cur], lo + done, count, n, arg);
+  }
+
+  my_free(buffer[0]);
+  MPI_File_close(&f);
+  st->seconds += MPI_Wtime();
 }
 /*
  * Function 'read_col_striped_matrix' reads a matrix from a
@@ -330,22 +2187,31 @@ void read_col_striped_matrix(
   int *n,		/* OUT - Cols */
   MPI_Comm comm)		/* IN - Communicator */
 {
-    void *buffer;	/* File buffer */
+    int batch;		/* Rows in a batch */
+    int *batch_count;	/* Each proc's count in a batch */
+    int *batch_disp;	/* Each proc's displacement in a batch */
+    char *blocks = NULL;	/* Batch, one block per proc */
+    char *buffer = NULL;	/* File buffer */
     int datum_size;	/* Size of matrix element */
-    int i, j;
+    int i, j, r;
     int id;		/* Process rank */
-    FILE *infileptr;	/* Input file ptr */
+    FILE *infileptr = NULL;	/* Input file ptr */
     int local_cols;	/* Cols on this process */
-    void **lptr;	/* Pointer into 'subs' */
-    void *rptr;		/* Pointer into 'storage' */
     int p;		/* Number of processes */
+    int rows;		/* Rows in a full batch */
     int *send_count;	/* Each proc's count */
     int *send_disp;	/* Each proc's displacement */
+    tiled_header h;	/* Header of a tiled file */
     
     MPI_Comm_size(comm, &p);
     MPI_Comm_rank(comm, &id);
     datum_size = get_size(dtype);
     
+    if(read_tiled_info(s, &h, comm)) {
+      read_tiled_matrix(s, LAYOUT_COLS, subs, storage, dtype, m, n, comm);
+      return;
+    }
+    
     /* Process p - 1 opens file, gets number of rows and
      * cols, and broadcasts this into to other procs
      */
@@ -364,34 +2230,47 @@ void read_col_striped_matrix(
     
     MPI_Bcast(n, 1, MPI_INT, p - 1, comm);
     
-    local_cols = BLOCK_SIZE(id, p, *n);
+    local_cols = block_size(id, p, *n, comm);
     
     /* Dynamically allocate two-dimensional matrix 'subs' */
-    *storage = my_malloc(id, *m * local_cols * datum_size);
-    *subs = (void **)my_malloc(id, *m * PTR_SIZE);
-    lptr = (void *) *subs;
-    
-    rptr = (void *) *storage;
-    for(i = 0; i < *m; i++) {
-     *(lptr++) = (void *)rptr;
-     rptr += local_cols * datum_size;
-    }
+    *storage = alloc_matrix_block(id, *m, local_cols, datum_size, subs);
     
-    /* Process p - 1 reads in the matrix one row at a time and
-     * distributes each row among the MPI processes
+    /* Process p - 1 reads in the matrix a batch of rows at a
+     * time, up to READ_CHUNK bytes, and lays each process's
+     * columns of the batch out as one block, so a batch is
+     * one scatter of contiguous blocks. Its rows land in
+     * consecutive rows of 'subs'
      */
-    if(id == (p - 1))
-      buffer = my_malloc(id, *n * datum_size);
-    create_mixed_xfer_arrays(id, p, *n, &send_count, &send_disp);
-    for(i = 0; i < *m; i++) {
-      if(id == (p - 1))
-	fread(buffer, datum_size, *n, infileptr);
-      MPI_Scatterv(buffer, send_count, send_disp, dtype, (*storage) + i * local_cols * datum_size, local_cols, dtype, p - 1, comm);
-    }
-    free(send_count);
-    free(send_disp);
-    if(id == (p - 1)) free(buffer);
-    
+    rows = MAX(1, READ_CHUNK / ((long long) *n * datum_size));
+    if(rows > *m) rows = *m;
+    create_mixed_xfer_arrays(id, p, *n, comm, &send_count, &send_disp);
+    batch_count = my_malloc(id, 2 * p * sizeof(int));
+    batch_disp = batch_count + p;
+    if(id == (p - 1)) {
+      buffer = scratch_buffer(id, SCRATCH_ROW, (size_t) rows * *n * datum_size);
+      blocks = scratch_buffer(id, SCRATCH_BLOCK, (size_t) rows * *n * datum_size);
+    }
+    for(i = 0; i < *m; i += batch) {
+      batch = MIN(rows, *m - i);
+      for(j = 0; j < p; j++) {
+	batch_count[j] = batch * send_count[j];
+	batch_disp[j] = batch * send_disp[j];
+      }
+      if(id == (p - 1)) {
+	fread(buffer, datum_size, (size_t) batch * *n, infileptr);
+	for(j = 0; j < p; j++)
+	  for(r = 0; r < batch; r++)
+	    memcpy(blocks + ((size_t) batch_disp[j] + (size_t) r * send_count[j]) * datum_size,
+		   buffer + ((size_t) r * *n + send_disp[j]) * datum_size, (size_t) send_count[j] * datum_size);
+      }
+      hier_scatterv(blocks, batch_count, batch_disp, dtype, (*subs)[i], batch * local_cols, p - 1, comm);
+    }
+    my_free(batch_count);
+    if(id == (p - 1)) {
+      release_scratch(SCRATCH_ROW);
+      release_scratch(SCRATCH_BLOCK);
+      fclose(infileptr);
+    }
 }
 
 /*
@@ -407,13 +2286,10 @@ void read_block_vector(
   MPI_Comm comm)	/* IN - Communicator */
 {
   int datum_size;	/* Bytes per element */
-  int i;
   FILE *infileptr;	/* Input file pointer */
   int local_els;	/* Elements on this proc */
-  MPI_Status status;	/* Result of receive */
   int id;		/* Process rank */
   int p;		/* Number of processes */
-  int x;		/* Result of read */
   
   datum_size = get_size(dtype);
   MPI_Comm_size(comm, &p);
@@ -426,7 +2302,7 @@ void read_block_vector(
   if(id == (p - 1)) {
    infileptr = fopen(s, "r");
    if(infileptr == NULL) *n = 0;
-   else fread(n, sizeof(int), i, infileptr);
+   else fread(n, sizeof(int), 1, infileptr);
   }
   MPI_Bcast(n, 1, MPI_INT, p - 1, comm);
   if(! *n) {
@@ -437,20 +2313,12 @@ void read_block_vector(
   }
   
   /* Block mapping of vector elements to processes */
-  local_els = BLOCK_SIZE(id, p, *n);
+  local_els = block_size(id, p, *n, comm);
   
   /* Dynamically allocate vector */
-  *v = my_malloc(id, local_els * datum_size);
-  if(id == (p - 1)) {
-   for(i = 0; i < p - 1; i++) {
-     x = fread(*v, datum_size, BLOCK_SIZE(i, p, *n), infileptr);
-     MPI_Send(*v, BLOCK_SIZE(i, p, *n), dtype, i, DATA_MSG, comm);
-   }
-   x = fread(*v, datum_size, BLOCK_SIZE(id, p, *n), infileptr);
-   fclose(infileptr);
-  } else {
-   MPI_Recv(*v, BLOCK_SIZE(id, p, *n), dtype, p - 1, DATA_MSG, comm, &status); 
-  }
+  *v = my_malloc(id, (size_t) local_els * datum_size);
+  read_scatter_blocks(infileptr, *n, 1, dtype, *v, comm);
+  if(id == (p - 1)) fclose(infileptr);
 }
   
 /* OUTPUT functions */
@@ -479,24 +2347,19 @@ void print_col_striped_matrix(
   MPI_Comm_rank(comm, &id);
   MPI_Comm_size(comm, &p);
   datum_size = get_size(dtype);
-  create_mixed_xfer_arrays(id, p, n, &rec_count, &rec_disp);
+  create_mixed_xfer_arrays(id, p, n, comm, &rec_count, &rec_disp);
   
   if(!id)
-    buffer = my_malloc(id, n * datum_size);
+    buffer = scratch_buffer(id, SCRATCH_ROW, (size_t) n * datum_size);
   
   for(i = 0; i < m; i++) {
-    MPI_Gatherv(a[i], BLOCK_SIZE(id, p, n), dtype, buffer, rec_count, rec_disp, dtype, 0, MPI_COMM_WORLD);
+    MPI_Gatherv(a[i], block_size(id, p, n, comm), dtype, buffer, rec_count, rec_disp, dtype, 0, MPI_COMM_WORLD);
     if(!id) {
      print_subvector(buffer, dtype, n);
      putchar('\n');
     }
   }
-  free(rec_count);
-  free(rec_disp);
-  if(!id) {
-   free(buffer);
-   putchar('\n');
-  }
+  if(!id) putchar('\n');
 }
 
 /*
@@ -557,33 +2420,23 @@ void print_block_vector(
   int n,		/* IN - ELements of vector */
   MPI_Comm comm)	/* IN - Communicator */
 {
+  void *buffer;		/* Whole vector, on process 0 */
+  int *cnt;		/* Elements of each process */
   int datum_size;	/* Bytes per vector element */
-  int i;
-  int prompt;		/* Dummy variable */
-  MPI_Status status;	/* Result of receive */
-  void *tmp;		/* Other process's subvector */
+  int *disp;		/* Their displacements */
   int id;		/* Process rank */
   int p;		/* Number of processes */
   
   MPI_Comm_size(comm, &p);
   MPI_Comm_rank(comm, &id);
   datum_size = get_size(dtype);
+  create_mixed_xfer_arrays(id, p, n, comm, &cnt, &disp);
+  buffer = !id ? scratch_buffer(id, SCRATCH_ROW, (size_t) n * datum_size) : NULL;
   
+  hier_gatherv(v, cnt[id], dtype, buffer, cnt, disp, 0, comm);
   if(!id) {
-   print_subvector(v, dtype, BLOCK_SIZE(id, p, n));
-   if(p > 1) {
-    tmp = my_malloc(id, BLOCK_SIZE(p - 1, p, n) * datum_size) ;
-    for(i = 1; i < p; i++) {
-     MPI_Send(&prompt, 1, MPI_INT, i, PROMPT_MSG, comm);
-     MPI_Recv(tmp, BLOCK_SIZE(i, p, n), dtype, i, RESPONSE_MSG, comm, &status);
-     print_subvector(tmp, dtype, BLOCK_SIZE(i, p, n));
-    }
-    free(tmp);
-   }
+   print_subvector(buffer, dtype, n);
    printf("\n\n");
-  } else {
-   MPI_Recv(&prompt, 1, MPI_INT, 0, PROMPT_MSG, comm, &status);
-   MPI_Send(v, BLOCK_SIZE(id, p, n), dtype, 0, RESPONSE_MSG, comm);
   }
 }
 
@@ -622,7 +2475,7 @@ void print_checkboard_matrix(
   local_cols = BLOCK_SIZE(grid_coords[1], grid_size[1], n);
   
   if(!grid_id)
-    buffer = my_malloc(grid_id, n * datum_size);
+    buffer = scratch_buffer(grid_id, SCRATCH_ROW, n * datum_size);
   
   /* For each row of the process grid */
   for(i = 0; i < grid_size[0]; i++) {
@@ -637,7 +2490,7 @@ void print_checkboard_matrix(
 	  coords[1] = k;
 	  MPI_Cart_rank(grid_comm, coords, &src);
 	  els = BLOCK_SIZE(k, grid_size[1], n);
-	  laddr = buffer + BLOCK_LOW(k, grid_size[1], n) * datum_size;
+	  laddr = (char *) buffer + BLOCK_LOW(k, grid_size[1], n) * datum_size;
 	  if(src == 0) {
 	    memcpy(laddr, a[j], els * datum_size);
 	  } else {
@@ -651,10 +2504,7 @@ void print_checkboard_matrix(
       }
     }
   }
-  if(!grid_id) {
-   free(buffer);
-   putchar('\n');
-  }
+  if(!grid_id) putchar('\n');
 }
 
 /*
@@ -684,32 +2534,29 @@ void print_row_striped_matrix(
   
   MPI_Comm_rank(comm, &id);
   MPI_Comm_size(comm, &p);
-  local_rows = BLOCK_SIZE(id, p, m);
+  local_rows = block_size(id, p, m, comm);
   if(!id) {
    print_submatrix(a, dtype, local_rows, n);
    if(p > 1) {
     datum_size = get_size(dtype);
-    max_block_size = BLOCK_SIZE(p - 1, p, m);
-    bstorage = my_malloc(id, max_block_size * n * datum_size);
-    b = (void **)my_malloc(id, max_block_size * datum_size);
-    b[0] = bstorage;
-    for(i = 1; i < max_block_size; i++) {
-      b[i] = b[i - 1] + n * datum_size;
-    }
+    for(max_block_size = 0, i = 1; i < p; i++)
+      if(block_size(i, p, m, comm) > max_block_size) max_block_size = block_size(i, p, m, comm);
+    bstorage = scratch_buffer(id, SCRATCH_BLOCK, (size_t) max_block_size * n * datum_size);
+    b = (void **)scratch_buffer(id, SCRATCH_ROW, max_block_size * PTR_SIZE);
+    for(i = 0; i < max_block_size; i++)
+      b[i] = (char *) bstorage + (size_t) i * n * datum_size;
     for(i = 1; i < p; i++) {
      MPI_Send(&prompt, 1, MPI_INT, i, PROMPT_MSG, MPI_COMM_WORLD);
-     MPI_Recv(bstorage, BLOCK_SIZE(i, p, m)*n, dtype,
-	      i, RESPONSE_MSG, MPI_COMM_WORLD, &status);
-     print_submatrix(b, dtype, BLOCK_SIZE(i, p, m), n);
+     big_recv(bstorage, (size_t) block_size(i, p, m, comm) * n, dtype,
+	      i, RESPONSE_MSG, MPI_COMM_WORLD);
+     print_submatrix(b, dtype, block_size(i, p, m, comm), n);
     }
-    free(b);
-    free(bstorage);
    }
    putchar('\n');
   } else {
     MPI_Recv(&prompt, 1, MPI_INT, 0, PROMPT_MSG,
 	     MPI_COMM_WORLD, &status);
-    MPI_Send(*a, local_rows * n, dtype, 0, RESPONSE_MSG,
+    big_send(*a, (size_t) local_rows * n, dtype, 0, RESPONSE_MSG,
 	     MPI_COMM_WORLD);
   }
 }
@@ -734,4 +2581,199 @@ void print_replicated_vector(
   }
 }
 
+/*
+ * Process p - 1 writes the matrix held in 'layout' to file
+ * 's', a strip of 'h->tile_rows' rows at a time: every
+ * process sends its part of the strip as a subarray, and
+ * the strip is written raw (legacy format, 'tiled' 0) or cut
+ * into tiles that are coded, summed and indexed. Returns the
+ * bytes of the payloads on every process.
+ *
+ * All processes must invoke this function together
+ */
+long long write_matrix_strips(
+  char *s,		/* IN - File name */
+  void *storage,	/* IN - Block of this process */
+  int layout,		/* IN - LAYOUT_... */
+  MPI_Datatype dtype,	/* IN - Element type */
+  tiled_header *h,	/* IN - Dimensions, strip height, format */
+  int tiled,		/* IN - Tiled or legacy file */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  FILE *outfileptr = NULL;
+  tiled_entry *index = NULL;
+  char *strip = NULL, *tile = NULL;
+  unsigned char *payload = NULL, *codec = NULL;
+  size_t es = h->elem_size, len;
+  long long down, across, ti, tj, r0, c0, s0, i, i0, i1;
+  long long offset = 0;	/* Where the next payload goes */
+  int rows, cols, krows, kcols, sh, th, tw, id, p, k, dims[2], ok = 1;
+  int sizes[2], sub[2], starts[2];
+  int sent;		/* This process has rows in the strip */
+  MPI_Datatype part;
+  MPI_Request req;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  tiled_grid(h, &down, &across);
+  if(id == (p - 1)) {
+    if((outfileptr = fopen(s, "wb")) == NULL) ok = 0;
+    else if(tiled) {
+      index = my_malloc(id, down * across * sizeof(tiled_entry) + 1);
+      tile = my_malloc(id, (size_t) h->tile_rows * h->tile_cols * es);
+      payload = my_malloc(id, compress_bound((size_t) h->tile_rows * h->tile_cols, es));
+      codec = my_malloc(id, (size_t) h->tile_rows * h->tile_cols * es);
+      offset = h->index + down * across * sizeof(tiled_entry);
+      fseek(outfileptr, offset, SEEK_SET);
+    } else {
+      dims[0] = (int) h->m;
+      dims[1] = (int) h->n;
+      fwrite(dims, sizeof(int), 2, outfileptr);
+    }
+    strip = my_malloc(id, (size_t) h->tile_rows * h->n * es + 1);
+  }
+  MPI_Bcast(&ok, 1, MPI_INT, p - 1, comm);
+  if(!ok) terminate(id, "Cannot create matrix file");
+
+  layout_block(layout, id, (int) h->m, (int) h->n, comm, &r0, &rows, &c0, &cols);
+  for(ti = 0; ti < down; ti++) {
+    s0 = ti * h->tile_rows;
+    tiled_shape(h, ti, 0, &sh, &tw);
+
+    /* This process's rows of the strip */
+    i0 = MAX(r0, s0);
+    i1 = MIN(r0 + rows, s0 + sh);
+    if((sent = i1 > i0 && cols > 0)) {
+      sizes[0] = rows;
+      sizes[1] = sub[1] = cols;
+      sub[0] = (int) (i1 - i0);
+      starts[0] = (int) (i0 - r0);
+      starts[1] = 0;
+      MPI_Type_create_subarray(2, sizes, sub, starts, MPI_ORDER_C, dtype, &part);
+      MPI_Type_commit(&part);
+      MPI_Isend(storage, 1, part, p - 1, DATA_MSG, comm, &req);
+    }
+
+    if(id == (p - 1)) {
+      for(k = 0; k < p; k++) {
+	long long k0, kc0;
+	MPI_Datatype place;
+	layout_block(layout, k, (int) h->m, (int) h->n, comm, &k0, &krows, &kc0, &kcols);
+	i0 = MAX(k0, s0);
+	i1 = MIN(k0 + krows, s0 + sh);
+	if(i1 <= i0 || kcols <= 0) continue;
+	sizes[0] = sh;
+	sizes[1] = (int) h->n;
+	sub[0] = (int) (i1 - i0);
+	sub[1] = kcols;
+	starts[0] = (int) (i0 - s0);
+	starts[1] = (int) kc0;
+	MPI_Type_create_subarray(2, sizes, sub, starts, MPI_ORDER_C, dtype, &place);
+	MPI_Type_commit(&place);
+	MPI_Recv(strip, 1, place, k, DATA_MSG, comm, MPI_STATUS_IGNORE);
+	MPI_Type_free(&place);
+      }
+      if(!tiled) fwrite(strip, es, (size_t) sh * h->n, outfileptr);
+      else for(tj = 0; tj < across; tj++) {
+	tiled_shape(h, ti, tj, &th, &tw);
+	for(i = 0; i < th; i++)
+	  memcpy(tile + i * tw * es, strip + (i * h->n + tj * h->tile_cols) * es, tw * es);
+	len = encode_tile(tile, (size_t) th * tw, h, payload, codec);
+	fwrite(payload, 1, len, outfileptr);
+	index[ti * across + tj].offset = offset;
+	index[ti * across + tj].bytes = len;
+	index[ti * across + tj].crc = crc32_update(0, payload, len);
+	index[ti * across + tj].reserved = 0;
+	offset += len;
+      }
+    }
+
+    if(sent) {
+      MPI_Wait(&req, MPI_STATUS_IGNORE);
+      MPI_Type_free(&part);
+    }
+  }
+
+  if(id == (p - 1)) {
+    if(tiled) {
+      offset -= h->index + down * across * sizeof(tiled_entry);
+      fseek(outfileptr, 0, SEEK_SET);
+      fwrite(h, sizeof(tiled_header), 1, outfileptr);
+      fwrite(index, sizeof(tiled_entry), down * across, outfileptr);
+      my_free(index);
+      my_free(tile);
+      my_free(payload);
+      my_free(codec);
+    } else offset = h->m * h->n * es;
+    fclose(outfileptr);
+    my_free(strip);
+  }
+  MPI_Bcast(&offset, 1, MPI_LONG_LONG, p - 1, comm);
+  return offset;
+}
+
+/*
+ * Write the distributed 'm' x 'n' matrix to file 's' in
+ * the tiled format, in tiles of 'tile_rows' x 'tile_cols'
+ * coded in 'compression' (lossy modes apply to doubles
+ * only; other types are coded losslessly). Returns the
+ * bytes of the tile payloads
+ */
+long long write_tiled_matrix(
+  char *s,		/* IN - File name */
+  void *storage,	/* IN - Block of this process */
+  int layout,		/* IN - LAYOUT_... it is held in */
+  int m,		/* IN - Matrix rows */
+  int n,		/* IN - Matrix cols */
+  MPI_Datatype dtype,	/* IN - Element type */
+  int tile_rows,	/* IN - Tile shape */
+  int tile_cols,
+  int compression,	/* IN - COMPRESS_... */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  tiled_header h;
+  int id;
+
+  MPI_Comm_rank(comm, &id);
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, TILED_MAGIC, 8);
+  h.version = TILED_VERSION;
+  h.order = TILED_ORDER;
+  h.type = tiled_type(dtype);
+  h.elem_size = get_size(dtype);
+  h.m = m;
+  h.n = n;
+  h.tile_rows = MAX(1, tile_rows);
+  h.tile_cols = MAX(1, tile_cols);
+  h.compression = compression;
+  if(compression != COMPRESS_NONE && h.type != TILED_DOUBLE) h.compression = COMPRESS_LOSSLESS;
+  h.index = TILED_HEADER;
+  if(!h.type) terminate(id, "No tiled element type for this datatype");
+  return write_matrix_strips(s, storage, layout, dtype, &h, 1, comm);
+}
+
+/*
+ * Write the distributed 'm' x 'n' matrix to file 's' in
+ * the legacy format: two ints, then the elements row by row
+ */
+void write_legacy_matrix(
+  char *s,		/* IN - File name */
+  void *storage,	/* IN - Block of this process */
+  int layout,		/* IN - LAYOUT_... it is held in */
+  int m,		/* IN - Matrix rows */
+  int n,		/* IN - Matrix cols */
+  MPI_Datatype dtype,	/* IN - Element type */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  tiled_header h;	/* Only the dimensions and strip height */
+
+  memset(&h, 0, sizeof(h));
+  h.elem_size = get_size(dtype);
+  h.m = m;
+  h.n = n;
+  h.tile_cols = MAX(1, n);
+  h.tile_rows = (int) MAX(1, MIN(m, (1 << 24) / ((long long) h.tile_cols * h.elem_size)));
+  write_matrix_strips(s, storage, layout, dtype, &h, 0, comm);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,101 @@
+
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "quadratureMPI.h"
+
+/*
+ * Numerical integration, hybrid MPI/OpenMP version
+ *
+ * Grown out of compute_pi_openmp.cpp: the same midpoint
+ * rule for pi, now split across MPI processes and their
+ * OpenMP threads, with 64-bit evaluation counts. With
+ * '-adaptive' a sharply peaked integrand is done instead by
+ * globally adaptive Gauss-Kronrod quadrature, rebalancing
+ * the intervals among the processes every round.
+ *
+ * Usage: integration_hybrid [n] [-adaptive tol]
+ *
+ * Run with e.g. OMP_NUM_THREADS=<cores per rank>, one rank
+ * per node or socket.
+ *
+ * Last modification: 18 October 2026
+ */
+
+/* 4/(1+x^2): integral over [0, 1] is pi */
+struct pi_integrand {
+  double operator()(double x) const { return 4.0 / (1.0 + x * x); }
+};
+
+/* Lorentzian peak at 'c' of half width 'w' */
+struct peak_integrand {
+  double c, w;
+  double operator()(double x) const { return 1.0 / ((x - c) * (x - c) + w * w); }
+  double exact(double a, double b) const { return (atan((b - c) / w) - atan((a - c) / w)) / w; }
+};
+
+int main(int argc, char *argv[])
+{
+  int adaptive;		/* Adaptive mode? */
+  double exact;		/* Known value of the integral */
+  int i;
+  int id;		/* Process rank */
+  long long n;		/* Evaluations, or initial intervals */
+  int p;		/* Number of processes */
+  int provided;		/* Thread support level */
+  double result;
+  quad_stats st;	/* Cost of the integration */
+  int threads;		/* OpenMP threads per process */
+  double tol;		/* Tolerance (adaptive mode) */
+
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+
+  n = 0;
+  adaptive = 0;
+  tol = 1e-10;
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-adaptive") && i + 1 < argc) {
+      adaptive = 1;
+      tol = atof(argv[++i]);
+    } else
+      n = atoll(argv[i]);
+  }
+  if(n <= 0) n = adaptive ? 16 * p : 1000000000LL;
+
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#else
+  threads = 1;
+#endif
+
+  if(adaptive) {
+    peak_integrand f;
+    f.c = 0.3;
+    f.w = 1e-4;
+    exact = f.exact(0.0, 1.0);
+    result = integrate_adaptive(f, 0.0, 1.0, n, tol, MPI_COMM_WORLD, &st);
+  } else {
+    pi_integrand f;
+    exact = M_PI;
+    result = integrate_midpoint(f, 0.0, 1.0, n, MPI_COMM_WORLD, &st);
+  }
+
+  if(!id) {
+    printf("%s: %d processes x %d threads\n", adaptive ? "Adaptive Gauss-Kronrod" : "Midpoint rule", p, threads);
+    printf("result = %.15f, error = %.3e", result, fabs(result - exact));
+    if(adaptive) printf(" (estimate %.3e, %d rounds)", st.error, st.rounds);
+    printf("\n");
+    printf("%.0f evaluations in %f seconds, %.3e evaluations/s\n",
+           st.evaluations, st.seconds, st.evaluations / st.seconds);
+    fflush(stdout);
+  }
+  MPI_Finalize();
+  return 0;
+}
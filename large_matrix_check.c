@@ -0,0 +1,142 @@
+/* Large matrix check, Version 1
+ *
+ * Writes a row-striped file of one-byte elements with more
+ * than 2^31 of them (the default shape), reads it back with
+ * 'read_row_striped_matrix' and checks it: every element
+ * against the pattern it was written with, and a checksum
+ * summed over all processes against the one computed while
+ * writing. The file is written with MPI-IO, each process
+ * its own block of rows, so no process holds more than its
+ * block.
+ *
+ * Build with lower MAX_COUNT and BIG_CHUNK (for instance
+ * -DMAX_COUNT=1000000 -DBIG_CHUNK=65536) to send the
+ * transfers through the derived-type path of 'big_send'.
+ *
+ * Usage: large_matrix_check <file> [rows cols] [-read]
+ *
+ * '-read' checks an existing file written by this program.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mpi.h>
+#include "helpersMPI.h"
+
+#define ROWS		64
+#define COLS		33554433	/* 64 x COLS = 2^31 + 64 */
+#define WRITE_CHUNK	(1 << 26)	/* Bytes per write call */
+
+/* Element 'k' of the matrix, counted row by row */
+unsigned char pattern(uint64_t k)
+{
+  return (unsigned char) ((k * 2654435761u) >> 24);
+}
+
+/*
+ * Checksum of 'count' elements starting with element 'k'
+ */
+uint64_t checksum(unsigned char *v, uint64_t k, size_t count)
+{
+  uint64_t sum = 0;
+  size_t i;
+
+  for(i = 0; i < count; i++) sum += (k + i + 1) * v[i];
+  return sum;
+}
+
+/*
+ * Write the file; returns this process's part of the checksum
+ */
+uint64_t write_matrix(char *name, int m, int n, MPI_Comm comm)
+{
+  MPI_File f;
+  unsigned char *buf;
+  uint64_t first, last;	/* This process's elements */
+  uint64_t k, sum = 0;
+  size_t i, len;
+  int dims[2];
+  int id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  first = (uint64_t) block_low(id, p, m, comm) * n;
+  last = (uint64_t) block_low(id + 1, p, m, comm) * n;
+  buf = my_malloc(id, WRITE_CHUNK);
+  MPI_File_open(comm, name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &f);
+  MPI_File_set_size(f, 0);
+  if(!id) {
+    dims[0] = m;
+    dims[1] = n;
+    MPI_File_write_at(f, 0, dims, 2, MPI_INT, MPI_STATUS_IGNORE);
+  }
+  for(k = first; k < last; k += len) {
+    len = MIN((uint64_t) WRITE_CHUNK, last - k);
+    for(i = 0; i < len; i++) buf[i] = pattern(k + i);
+    sum += checksum(buf, k, len);
+    MPI_File_write_at(f, (MPI_Offset) (2 * sizeof(int) + k), buf, (int) len, MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+  MPI_File_close(&f);
+  my_free(buf);
+  return sum;
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned char **a;	/* Block of rows */
+  void *storage;	/* Its elements */
+  int check_only = 0;	/* Only read an existing file */
+  uint64_t local[2];	/* Written checksum, read checksum */
+  uint64_t global[2];
+  long long bad, all_bad;	/* Elements that differ */
+  uint64_t first, i;
+  double t_write = 0.0, t_read;
+  int id, p, m, n;
+  int rows = ROWS, cols = COLS;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  if(argc > 2 && atoi(argv[2]) > 0) rows = atoi(argv[2]);
+  if(argc > 3 && atoi(argv[3]) > 0) cols = atoi(argv[3]);
+  if(!strcmp(argv[argc - 1], "-read")) check_only = 1;
+  if(argc < 2) {
+    if(!id) printf("Command line: %s <file> [rows cols] [-read]\n", argv[0]);
+    MPI_Finalize();
+    exit(1);
+  }
+
+  local[0] = 0;
+  if(!check_only) {
+    t_write = -MPI_Wtime();
+    local[0] = write_matrix(argv[1], rows, cols, MPI_COMM_WORLD);
+    t_write += MPI_Wtime();
+  }
+
+  t_read = -MPI_Wtime();
+  read_row_striped_matrix(argv[1], (void ***) &a, &storage, MPI_BYTE, &m, &n, MPI_COMM_WORLD);
+  t_read += MPI_Wtime();
+
+  first = (uint64_t) block_low(id, p, m, MPI_COMM_WORLD) * n;
+  local[1] = checksum((unsigned char *) storage, first, (size_t) block_size(id, p, m, MPI_COMM_WORLD) * n);
+  for(bad = 0, i = 0; i < (uint64_t) block_size(id, p, m, MPI_COMM_WORLD) * n; i++)
+    if(((unsigned char *) storage)[i] != pattern(first + i)) bad++;
+  MPI_Reduce(local, global, 2, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+  MPI_Reduce(&bad, &all_bad, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+  if(!id) {
+    printf("%d x %d matrix, %lld elements (2^31 = %lld)\n", m, n, (long long) m * n, 1LL << 31);
+    if(!check_only) printf("Written in %.3f s, checksum %016llx\n", t_write, (unsigned long long) global[0]);
+    printf("Read in %.3f s, checksum %016llx\n", t_read, (unsigned long long) global[1]);
+    printf("%lld elements differ: %s\n", all_bad,
+	   !all_bad && (check_only || global[0] == global[1]) ? "OK" : "FAILED");
+  }
+
+  my_free(storage);
+  my_finalize();
+  return 0;
+}
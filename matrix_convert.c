@@ -0,0 +1,111 @@
+/* Matrix file converter, Version 1
+ *
+ * Converts a matrix file between the legacy format (two
+ * ints, then the elements row by row) and the tiled
+ * container of tiledMPI.h, in either direction: a legacy
+ * input becomes tiled and a tiled input becomes legacy,
+ * unless '-tiled' or '-legacy' says otherwise. The matrix is
+ * read and written block-distributed, so it needs to fit in
+ * the memory of all the processes together, not of one.
+ *
+ * Legacy files do not record their element type; '-type'
+ * gives it (double by default). Tiled files carry theirs.
+ *
+ * Usage: matrix_convert <in> <out> [-type char|int|float|double]
+ *        [-tile RxC] [-compress none|lossless|float|bf16]
+ *        [-tiled | -legacy]
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include "helpersMPI.h"
+
+int main(int argc, char * argv[]) {
+
+  void **a;			/* Matrix block, by rows */
+  void *storage;		/* Its elements */
+  MPI_Datatype dtype = MPI_DOUBLE;	/* Element type */
+  tiled_header h;		/* Header of a tiled input */
+  int tiled_in;			/* Input is tiled */
+  int tiled_out = -1;		/* Output is tiled; -1: the other format */
+  int tile_rows = 256;		/* Tile shape */
+  int tile_cols = 256;
+  int compression = COMPRESS_NONE;
+  long long bytes;		/* Payload written */
+  double elapsed_time;
+  int id, p, m, n, i;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &id);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  init_block_weights(MPI_COMM_WORLD);
+
+  for(i = 3; i < argc; i++) {
+    if(!strcmp(argv[i], "-type") && i + 1 < argc) {
+      i++;
+      if(!strcmp(argv[i], "char")) dtype = MPI_CHAR;
+      else if(!strcmp(argv[i], "int")) dtype = MPI_INT;
+      else if(!strcmp(argv[i], "float")) dtype = MPI_FLOAT;
+      else if(!strcmp(argv[i], "double")) dtype = MPI_DOUBLE;
+      else break;
+    } else if(!strcmp(argv[i], "-tile") && i + 1 < argc) {
+      if(sscanf(argv[++i], "%dx%d", &tile_rows, &tile_cols) != 2 || tile_rows < 1 || tile_cols < 1) break;
+    } else if(!strcmp(argv[i], "-compress") && i + 1 < argc) {
+      i++;
+      if(!strcmp(argv[i], "none")) compression = COMPRESS_NONE;
+      else if(!strcmp(argv[i], "lossless")) compression = COMPRESS_LOSSLESS;
+      else if(!strcmp(argv[i], "float")) compression = COMPRESS_FLOAT;
+      else if(!strcmp(argv[i], "bf16")) compression = COMPRESS_BF16;
+      else break;
+    } else if(!strcmp(argv[i], "-tiled")) tiled_out = 1;
+    else if(!strcmp(argv[i], "-legacy")) tiled_out = 0;
+    else break;
+  }
+  if(argc < 3 || i < argc) {
+    if(!id) printf("Command line: %s <in> <out> [-type char|int|float|double] [-tile RxC]\n"
+		   "       [-compress none|lossless|float|bf16] [-tiled | -legacy]\n", argv[0]);
+    MPI_Finalize();
+    exit(1);
+  }
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  elapsed_time = -MPI_Wtime();
+
+  /* A tiled input names its own element type */
+  tiled_in = read_tiled_info(argv[1], &h, MPI_COMM_WORLD) != 0;
+  if(tiled_in)
+    switch(h.type) {
+    case TILED_CHAR: dtype = MPI_CHAR; break;
+    case TILED_INT: dtype = MPI_INT; break;
+    case TILED_FLOAT: dtype = MPI_FLOAT; break;
+    default: dtype = MPI_DOUBLE;
+    }
+  if(tiled_out < 0) tiled_out = !tiled_in;
+
+  read_row_striped_matrix(argv[1], (void *) &a, &storage, dtype, &m, &n, MPI_COMM_WORLD);
+  if(tiled_out)
+    bytes = write_tiled_matrix(argv[2], storage, LAYOUT_ROWS, m, n, dtype, tile_rows, tile_cols,
+			       compression, MPI_COMM_WORLD);
+  else {
+    write_legacy_matrix(argv[2], storage, LAYOUT_ROWS, m, n, dtype, MPI_COMM_WORLD);
+    bytes = (long long) m * n * get_size(dtype);
+  }
+
+  elapsed_time += MPI_Wtime();
+  if(!id) {
+    printf("%d x %d matrix: %s %s -> %s %s\n", m, n, tiled_in ? "tiled" : "legacy", argv[1],
+	   tiled_out ? "tiled" : "legacy", argv[2]);
+    if(tiled_out)
+      printf("%d x %d tiles, payload %lld bytes (%.1f%% of the elements)\n", tile_rows, tile_cols, bytes,
+	     100.0 * bytes / MAX(1, (double) m * n * get_size(dtype)));
+    printf("Total elapsed time: %10.6f\n", elapsed_time);
+  }
+
+  my_free(storage);
+  my_finalize();
+  return 0;
+}
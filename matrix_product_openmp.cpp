@@ -1,33 +1,544 @@
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
 #include <omp.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+/*
+ * Matrix product, OpenMP, NUMA aware
+ *
+ * The matrices are allocated page aligned and initialized
+ * in parallel with the same static schedule as the product
+ * loop, so with the kernel's first-touch policy each thread's
+ * rows land in its own socket's memory. '-interleave'
+ * instead spreads the pages round robin over the threads
+ * (and so the sockets), which suits 'b', read in full by
+ * every thread. '-bind compact|spread' pins thread t to a
+ * CPU, filling one socket first or alternating sockets.
+ *
+ * The report gives the read bandwidth per socket, measured
+ * over each thread's own rows, next to the product time.
+ *
+ * Recursive product: '-recursive' copies 'a' and 'b' into
+ * Morton order, TILE x TILE row-major tiles laid out along
+ * a Z curve (the size padded with zeros to TILE times a
+ * power of 2), so every quadrant of every level is one
+ * contiguous block. The product splits into quadrants down
+ * to a tile, the four quadrants of 'c' as OpenMP tasks down
+ * to TASK_MIN, and multiplies tiles with an i-k-j kernel.
+ * '-strassen' does the same below the cutoff ('-cutoff c',
+ * CUTOFF by default) and Strassen's 7 products, each a task,
+ * above it, trading an eighth of the flops per level for
+ * up to 4 n^2 extra doubles on the top level. The report
+ * gives the GFLOP/s-equivalent (2 n^3 / time) and the
+ * largest relative error over sampled elements of 'c';
+ * '-sweep' repeats the product for n = 1024, 2048, ..., n
+ * (just n when n is smaller). 'a' and 'b' hold uniform
+ * random values from erand48, seeded per row, so the sums
+ * are not exact and the error shows each method's rounding.
+ *
+ * Usage: matrix_product [n] [-interleave] [-bind none|compact|spread]
+ *        [-recursive | -strassen] [-cutoff c] [-sweep]
+ *
+ * Last modification: 18 October 2026
+ */
 
 #define N 4096
+#define MAX_SOCKETS 16
+#define TILE 64		/* Side of a Morton tile */
+#define TASK_MIN 256	/* Smaller blocks stay in their parent's task */
+#define CUTOFF 512	/* Largest block multiplied without Strassen */
+#define SAMPLES 64	/* Elements of 'c' checked */
+#define SEED 2026	/* Of the random elements of 'a' and 'b' */
+
+enum { BIND_NONE, BIND_COMPACT, BIND_SPREAD };
+enum { PRODUCT_LOOP, PRODUCT_RECURSIVE, PRODUCT_STRASSEN };
+
+int page_doubles;	/* Doubles per page */
+int cutoff = CUTOFF;	/* Strassen above this block size */
+
+/* Socket of 'cpu', 0 if unknown */
+int cpu_socket(int cpu)
+{
+  char path[128];
+  FILE *f;
+  int s = 0;
+
+  sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  if((f = fopen(path, "r")) != NULL) {
+    if(fscanf(f, "%d", &s) != 1 || s < 0) s = 0;
+    fclose(f);
+  }
+  return s % MAX_SOCKETS;
+}
+
+/* Socket the calling thread runs on */
+int current_socket()
+{
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  if(cpu >= 0) return cpu_socket(cpu);
+#endif
+  return 0;
+}
+
+/*
+ * Pin each OpenMP thread to one CPU of the process's
+ * affinity mask. 'compact' takes the CPUs socket by socket,
+ * 'spread' takes one from each socket in turn
+ */
+void bind_threads(int mode)
+{
+#ifdef __linux__
+  cpu_set_t mask;
+  int *order;		/* CPUs in binding order */
+  int cnt = 0;		/* CPUs available */
+  int cpu, s, i;
+
+  if(mode == BIND_NONE || sched_getaffinity(0, sizeof(mask), &mask)) return;
+  order = (int *) malloc(CPU_SETSIZE * sizeof(int));
+  if(mode == BIND_COMPACT) {
+    for(s = 0; s < MAX_SOCKETS; s++)
+      for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if(CPU_ISSET(cpu, &mask) && cpu_socket(cpu) == s) order[cnt++] = cpu;
+  } else {
+    int next[MAX_SOCKETS] = {0};	/* Next CPU to look at per socket */
+    int found = 1;
+    while(found) {
+      found = 0;
+      for(s = 0; s < MAX_SOCKETS; s++) {
+        for(cpu = next[s]; cpu < CPU_SETSIZE; cpu++)
+          if(CPU_ISSET(cpu, &mask) && cpu_socket(cpu) == s) break;
+        next[s] = cpu + 1;
+        if(cpu < CPU_SETSIZE) {
+          order[cnt++] = cpu;
+          found = 1;
+        }
+      }
+    }
+  }
+
+  #pragma omp parallel private(i)
+  {
+    cpu_set_t own;
+    i = omp_get_thread_num();
+    CPU_ZERO(&own);
+    CPU_SET(order[i % cnt], &own);
+    sched_setaffinity(0, sizeof(own), &own);
+  }
+  free(order);
+#endif
+}
+
+double *alloc_matrix(int n)
+{
+  void *m;
+
+  if(posix_memalign(&m, page_doubles * sizeof(double), (size_t) n * n * sizeof(double))) {
+    printf("Not enough memory\n");
+    exit(1);
+  }
+  return (double *) m;
+}
+
+/*
+ * Make each page of 'm' resident on the socket that will use
+ * it: by rows with the product loop's schedule, or round
+ * robin by page when interleaving
+ */
+void first_touch(double *m, int n, int interleave)
+{
+  long total = (long) n * n;
+  long pages = (total + page_doubles - 1) / page_doubles;
+  long pg, i;
+
+  if(interleave) {
+    #pragma omp parallel private(pg, i)
+    {
+      int t = omp_get_thread_num(), nt = omp_get_num_threads();
+      for(pg = t; pg < pages; pg += nt)
+        for(i = pg * page_doubles; i < total && i < (pg + 1) * page_doubles; i++) m[i] = 0.0;
+    }
+  } else {
+    int r;
+    #pragma omp parallel for schedule(static) private(i)
+    for(r = 0; r < n; r++)
+      for(i = 0; i < n; i++) m[(long) r * n + i] = 0.0;
+  }
+}
+
+/*
+ * Read bandwidth per socket: each thread sums its own rows
+ * of 'm' (same schedule as the product); a socket's rate is
+ * its bytes over the time of its slowest thread, after a
+ * warm-up pass
+ */
+void socket_bandwidth(double *m, int n)
+{
+  double bytes[MAX_SOCKETS] = {0}, secs[MAX_SOCKETS] = {0};
+  int threads[MAX_SOCKETS] = {0};
+  double check = 0.0;
+  int s;
+
+  #pragma omp parallel reduction(+:check)
+  {
+    int r, i, pass, rows = 0, sock;
+    double t = 0.0;
+    for(pass = 0; pass < 2; pass++) {	/* First pass warms up */
+      rows = 0;
+      t = omp_get_wtime();
+      #pragma omp for schedule(static) nowait
+      for(r = 0; r < n; r++) {
+        for(i = 0; i < n; i++) check += m[(long) r * n + i];
+        rows++;
+      }
+      t = omp_get_wtime() - t;
+    }
+    sock = current_socket();
+    #pragma omp critical
+    {
+      bytes[sock] += (double) rows * n * sizeof(double);
+      if(t > secs[sock]) secs[sock] = t;
+      threads[sock]++;
+    }
+  }
+
+  printf("Socket  Threads  Read GB/s\n");
+  for(s = 0; s < MAX_SOCKETS; s++)
+    if(threads[s])
+      printf("%6d  %7d  %9.2f\n", s, threads[s], secs[s] > 0.0 ? bytes[s] / secs[s] / 1e9 : 0.0);
+  if(check == -1.0) printf(" ");	/* Keep the sum live */
+}
+
+/* Spread the bits of 'x' to the even positions */
+unsigned long spread_bits(unsigned long x)
+{
+  unsigned long r = 0;
+  int b;
+
+  for(b = 0; b < 32; b++) r |= ((x >> b) & 1UL) << (2 * b);
+  return r;
+}
+
+/* First element of tile (ti, tj) in Morton storage */
+long morton_tile(int ti, int tj)
+{
+  return (long) ((spread_bits(ti) << 1) | spread_bits(tj)) * TILE * TILE;
+}
+
+double *alloc_block(long count)
+{
+  void *m;
+
+  if(posix_memalign(&m, 64, count * sizeof(double))) {
+    printf("Not enough memory\n");
+    exit(1);
+  }
+  return (double *) m;
+}
 
-double a[N][N], b[N][N], c[N][N];
+/*
+ * Row-major 'n' x 'n' matrix 'm' to (or, 'back', from)
+ * Morton storage 'z' of side 'size', padded with zeros
+ */
+void morton_copy(double *m, double *z, int n, int size, int back)
+{
+  int ti, tj, tiles = size / TILE;
 
-int main() {
+  #pragma omp parallel for collapse(2) schedule(static)
+  for(ti = 0; ti < tiles; ti++)
+    for(tj = 0; tj < tiles; tj++) {
+      double *t = z + morton_tile(ti, tj);
+      int r, k, i, j;
+      for(r = 0; r < TILE; r++)
+        for(k = 0; k < TILE; k++) {
+          i = ti * TILE + r;
+          j = tj * TILE + k;
+          if(back) {
+            if(i < n && j < n) m[(long) i * n + j] = t[r * TILE + k];
+          } else t[r * TILE + k] = i < n && j < n ? m[(long) i * n + j] : 0.0;
+        }
+    }
+}
+
+/* c += a b for TILE x TILE row-major tiles */
+void tile_kernel(const double *a, const double *b, double *c)
+{
   int i, j, k;
-  double t1, t2;
-
-  /* matrix initialization */
-  printf("Matrix initialization\n");
-  for(i = 0; i < N; i++)
-    for(j = 0; j < N; j++)
-      a[i][j] = b[i][j] = i*j;
-
-  t1 = omp_get_wtime();
-  /* main computational block */
-  printf("Matrix multiplication\n");
-  #pragma omp parallel for shared(a, b, c) private(i, j, k)
-    for(i = 0; i < N; i++) {
-      for(j = 0; j < N; j++) {
-	c[i][j] = 0.0;
-	for(k = 0; k < N; k++) c[i][j] += a[i][k]*b[k][j];
+
+  for(i = 0; i < TILE; i++)
+    for(k = 0; k < TILE; k++) {
+      double aik = a[i * TILE + k];
+      for(j = 0; j < TILE; j++) c[i * TILE + j] += aik * b[k * TILE + j];
+    }
+}
+
+/*
+ * c += a b for Morton blocks of side 's': the quadrants of
+ * 'c' are updated by four tasks with the first half of the
+ * inner dimension, then four with the second
+ */
+void recursive_add(const double *a, const double *b, double *c, int s)
+{
+  long q = (long) s / 2 * (s / 2);	/* Elements per quadrant */
+  int h, big = s > TASK_MIN;
+
+  if(s == TILE) {
+    tile_kernel(a, b, c);
+    return;
+  }
+  for(h = 0; h < 2; h++) {
+    #pragma omp task if(big)
+    recursive_add(a + h * q, b + 2 * h * q, c, s / 2);
+    #pragma omp task if(big)
+    recursive_add(a + h * q, b + (2 * h + 1) * q, c + q, s / 2);
+    #pragma omp task if(big)
+    recursive_add(a + (2 + h) * q, b + 2 * h * q, c + 2 * q, s / 2);
+    #pragma omp task if(big)
+    recursive_add(a + (2 + h) * q, b + (2 * h + 1) * q, c + 3 * q, s / 2);
+    #pragma omp taskwait
+  }
+}
+
+/* z = x + sign * y over 'q' elements */
+void block_sum(const double *x, const double *y, double *z, long q, double sign)
+{
+  long i;
+
+  for(i = 0; i < q; i++) z[i] = x[i] + sign * y[i];
+}
+
+/*
+ * c = a b for Morton blocks of side 's': Strassen's seven
+ * products, one task each, above the cutoff; the recursive
+ * product below it
+ */
+void strassen(const double *a, const double *b, double *c, int s)
+{
+  long q = (long) s / 2 * (s / 2);
+  const double *a11 = a, *a12 = a + q, *a21 = a + 2 * q, *a22 = a + 3 * q;
+  const double *b11 = b, *b12 = b + q, *b21 = b + 2 * q, *b22 = b + 3 * q;
+  double *m[7];		/* The products */
+  int i;
+
+  if(s <= cutoff || s == TILE) {
+    memset(c, 0, (size_t) s * s * sizeof(double));
+    recursive_add(a, b, c, s);
+    return;
+  }
+  for(i = 0; i < 7; i++) m[i] = alloc_block(q);
+
+  #pragma omp task
+  {
+    double *x = alloc_block(q), *y = alloc_block(q);
+    block_sum(a11, a22, x, q, 1.0);
+    block_sum(b11, b22, y, q, 1.0);
+    strassen(x, y, m[0], s / 2);		/* (A11 + A22)(B11 + B22) */
+    free(x);
+    free(y);
+  }
+  #pragma omp task
+  {
+    double *x = alloc_block(q);
+    block_sum(a21, a22, x, q, 1.0);
+    strassen(x, b11, m[1], s / 2);		/* (A21 + A22) B11 */
+    free(x);
+  }
+  #pragma omp task
+  {
+    double *y = alloc_block(q);
+    block_sum(b12, b22, y, q, -1.0);
+    strassen(a11, y, m[2], s / 2);		/* A11 (B12 - B22) */
+    free(y);
+  }
+  #pragma omp task
+  {
+    double *y = alloc_block(q);
+    block_sum(b21, b11, y, q, -1.0);
+    strassen(a22, y, m[3], s / 2);		/* A22 (B21 - B11) */
+    free(y);
+  }
+  #pragma omp task
+  {
+    double *x = alloc_block(q);
+    block_sum(a11, a12, x, q, 1.0);
+    strassen(x, b22, m[4], s / 2);		/* (A11 + A12) B22 */
+    free(x);
+  }
+  #pragma omp task
+  {
+    double *x = alloc_block(q), *y = alloc_block(q);
+    block_sum(a21, a11, x, q, -1.0);
+    block_sum(b11, b12, y, q, 1.0);
+    strassen(x, y, m[5], s / 2);		/* (A21 - A11)(B11 + B12) */
+    free(x);
+    free(y);
+  }
+  #pragma omp task
+  {
+    double *x = alloc_block(q), *y = alloc_block(q);
+    block_sum(a12, a22, x, q, -1.0);
+    block_sum(b21, b22, y, q, 1.0);
+    strassen(x, y, m[6], s / 2);		/* (A12 - A22)(B21 + B22) */
+    free(x);
+    free(y);
+  }
+  #pragma omp taskwait
+
+  /* C11 = M1 + M4 - M5 + M7, C12 = M3 + M5,
+   * C21 = M2 + M4, C22 = M1 - M2 + M3 + M6
+   */
+  #pragma omp task
+  for(long k = 0; k < q; k++) c[k] = m[0][k] + m[3][k] - m[4][k] + m[6][k];
+  #pragma omp task
+  for(long k = 0; k < q; k++) c[q + k] = m[2][k] + m[4][k];
+  #pragma omp task
+  for(long k = 0; k < q; k++) c[2 * q + k] = m[1][k] + m[3][k];
+  #pragma omp task
+  for(long k = 0; k < q; k++) c[3 * q + k] = m[0][k] - m[1][k] + m[2][k] + m[5][k];
+  #pragma omp taskwait
+  for(i = 0; i < 7; i++) free(m[i]);
+}
+
+/*
+ * c = a b by 'mode'; returns the seconds taken, Morton
+ * copies included
+ */
+double multiply(double *a, double *b, double *c, int n, int mode)
+{
+  double *za, *zb, *zc;
+  double t = omp_get_wtime();
+  int i, j, k, size;
+
+  if(mode == PRODUCT_LOOP) {
+    #pragma omp parallel for schedule(static) private(i, j, k)
+      for(i = 0; i < n; i++) {
+        for(j = 0; j < n; j++) {
+	  double sum = 0.0;
+	  for(k = 0; k < n; k++) sum += a[(long) i * n + k] * b[(long) k * n + j];
+	  c[(long) i * n + j] = sum;
+        }
       }
+    return omp_get_wtime() - t;
+  }
+
+  for(size = TILE; size < n; size *= 2);
+  za = alloc_block((long) size * size);
+  zb = alloc_block((long) size * size);
+  zc = alloc_block((long) size * size);
+  morton_copy(a, za, n, size, 0);
+  morton_copy(b, zb, n, size, 0);
+  #pragma omp parallel
+  #pragma omp single
+  {
+    if(mode == PRODUCT_STRASSEN) strassen(za, zb, zc, size);
+    else {
+      memset(zc, 0, (size_t) size * size * sizeof(double));
+      recursive_add(za, zb, zc, size);
+    }
+  }
+  morton_copy(c, zc, n, size, 1);
+  free(za);
+  free(zb);
+  free(zc);
+  return omp_get_wtime() - t;
+}
+
+/*
+ * Largest error of SAMPLES elements of 'c', each relative
+ * to the sum of the magnitudes of its terms
+ */
+double sampled_error(double *a, double *b, double *c, int n)
+{
+  double worst = 0.0, sum, mag;
+  int s, i, j, k;
+
+  srand(1);
+  for(s = 0; s < SAMPLES; s++) {
+    i = rand() % n;
+    j = rand() % n;
+    for(sum = mag = 0.0, k = 0; k < n; k++) {
+      sum += a[(long) i * n + k] * b[(long) k * n + j];
+      mag += fabs(a[(long) i * n + k] * b[(long) k * n + j]);
+    }
+    if(mag > 0.0 && fabs(c[(long) i * n + j] - sum) / mag > worst) worst = fabs(c[(long) i * n + j] - sum) / mag;
+  }
+  return worst;
+}
+
+int main(int argc, char *argv[]) {
+  double *a, *b, *c;
+  int bind = BIND_NONE;
+  int interleave = 0;
+  int mode = PRODUCT_LOOP;
+  int sweep = 0;
+  int n = N;
+  int i, j, size;
+  double t;
+  const char *name[] = { "loop", "recursive", "Strassen" };
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-interleave")) interleave = 1;
+    else if(!strcmp(argv[i], "-bind") && i + 1 < argc) {
+      i++;
+      if(!strcmp(argv[i], "compact")) bind = BIND_COMPACT;
+      else if(!strcmp(argv[i], "spread")) bind = BIND_SPREAD;
+    } else if(!strcmp(argv[i], "-recursive")) mode = PRODUCT_RECURSIVE;
+    else if(!strcmp(argv[i], "-strassen")) mode = PRODUCT_STRASSEN;
+    else if(!strcmp(argv[i], "-cutoff") && i + 1 < argc) cutoff = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-sweep")) sweep = 1;
+    else if(atoi(argv[i]) > 0) n = atoi(argv[i]);
+  }
+  page_doubles = sysconf(_SC_PAGESIZE) / sizeof(double);
+  bind_threads(bind);
+
+  if(sweep) printf("%8s %12s %12s %12s\n", "N", "Time", "GFLOP/s", "Error");
+  for(size = sweep && n > 1024 ? 1024 : n; size <= n; size *= 2) {
+
+    /* matrix initialization */
+    if(!sweep) printf("Matrix initialization (%s)\n", interleave ? "interleaved" : "first touch");
+    a = alloc_matrix(size);
+    b = alloc_matrix(size);
+    c = alloc_matrix(size);
+    first_touch(a, size, interleave);
+    first_touch(b, size, interleave);
+    first_touch(c, size, interleave);
+    #pragma omp parallel for schedule(static) private(j)
+    for(i = 0; i < size; i++) {
+      unsigned short xa[3] = { (unsigned short) i, (unsigned short) (i >> 16), SEED };
+      unsigned short xb[3] = { (unsigned short) i, (unsigned short) (i >> 16), SEED + 1 };
+      for(j = 0; j < size; j++) {
+        a[(long) i * size + j] = erand48(xa);
+        b[(long) i * size + j] = erand48(xb);
+      }
+    }
+
+    if(!sweep) {
+      socket_bandwidth(a, size);
+      printf("Matrix multiplication (%s", name[mode]);
+      if(mode == PRODUCT_STRASSEN) printf(", cutoff %d", cutoff);
+      printf(")\n");
+    }
+
+    /* main computational block */
+    t = multiply(a, b, c, size, mode);
+    if(sweep)
+      printf("%8d %12.3lf %12.2lf %12.2e\n", size, t, 2.0 * size * size * size / t * 1e-9,
+             sampled_error(a, b, c, size));
+    else {
+      printf("Time = %lf\n", t);
+      printf("GFLOP/s-equivalent = %.2lf\n", 2.0 * size * size * size / t * 1e-9);
+      printf("Max relative error = %.2e\n", sampled_error(a, b, c, size));
     }
-  t2 = omp_get_wtime();
-  printf("Time = %lf\n", t2 - t1);
 
+    free(a);
+    free(b);
+    free(c);
+  }
   return 0;
-}
\ No newline at end of file
+}
@@ -14,6 +14,19 @@
  * 
  * Time Complexity - O(mn)
  * 
+ * Vectors 'b' and 'c' are replicated once per node, in
+ * shared memory, rather than once per process
+ * 
+ * With '-stream MB' the matrix is never held in memory:
+ * each process streams its rows from the file in chunks of
+ * at most MB megabytes, reading the next chunk while it
+ * multiplies the current one. The sustained rate is
+ * reported next to that of a second pass that only reads
+ * (served from the page cache, in part, when the file fits
+ * there)
+ * 
+ * Usage: matrix_vector_multiplication <matrix> <vector> [-stream MB]
+ * 
  * Author: Michael Quinn
  * 
  * Last modification: 16 May 2016
@@ -23,6 +36,7 @@
 #include <stdio.h>
 #include <mpi.h>
 #include <stdlib.h>
+#include <string.h>
 #include "helpersMPI.h"
 
 /* Change these two definitions when the matrix and vector  element types changes */
@@ -30,6 +44,48 @@
 typedef double dtype;
 #define mpitype MPI_DOUBLE
 
+/* Where the rows of a streamed matrix go */
+typedef struct {
+  dtype *b;		/* Replicated vector */
+  dtype *c_block;	/* This process's products */
+  long long lo;		/* Its first row */
+} stream_product;
+
+/*
+ * Multiply 'count' rows, from row 'first', by 'b'
+ */
+void multiply_rows(void *rows, long long first, int count, int n, void *arg)
+{
+  stream_product *sp = (stream_product *) arg;
+  dtype *a = (dtype *) rows;
+  dtype sum;
+  int i, j;
+
+  for(i = 0; i < count; i++) {
+    sum = 0.0;
+    for(j = 0; j < n; j++)
+      sum += a[(size_t) i * n + j] * sp->b[j];
+    sp->c_block[first - sp->lo + i] = sum;
+  }
+}
+
+/*
+ * Aggregate rate of a streamed pass: total bytes over the
+ * slowest process's time, in GB/s
+ */
+double stream_rate(stream_stats *st, double *wait, MPI_Comm comm)
+{
+  long long bytes;
+  double seconds[2], slowest[2];
+
+  seconds[0] = st->seconds;
+  seconds[1] = st->wait;
+  MPI_Reduce(&st->bytes, &bytes, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  MPI_Reduce(seconds, slowest, 2, MPI_DOUBLE, MPI_MAX, 0, comm);
+  *wait = slowest[1] / slowest[0];
+  return bytes / slowest[0] / 1e9;
+}
+
 int main(int argc, char * argv[]) {
 
   dtype **a;		/* First factor, a matrix */
@@ -37,6 +93,8 @@ int main(int argc, char * argv[]) {
   dtype *c_block;	/* Partial product vector */
   dtype *c;		/* Replicated product vector */
   dtype *storage;	/* Matrix elements stored here */
+  shared_segment b_seg;	/* Node's copy of 'b' */
+  shared_segment c_seg;	/* Node's copy of 'c' */
   int i, j;		/* Loop indices */
   int id; 		/* Process ID number */
   int m;		/* Rows in matrix */
@@ -44,20 +102,57 @@ int main(int argc, char * argv[]) {
   int nprime;		/* Elements in vector */
   int p;		/* Number of processes */
   int rows;		/* Number of rows on this process */
+  double stream_mb = 0;	/* Chunk size when streaming */
+  stream_product sp;	/* Streamed multiply */
+  stream_stats st;	/* Its bytes and times */
+  double rate, raw, wait, raw_wait;	/* GB/s, waiting share */
   
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  init_block_weights(MPI_COMM_WORLD);
+  
+  if(argc == 5 && !strcmp(argv[3], "-stream")) stream_mb = atof(argv[4]);
+  if(argc < 3 || (argc != 3 && stream_mb <= 0)) {
+    if(!id) printf("Command line: %s <matrix> <vector> [-stream MB]\n", argv[0]);
+    MPI_Finalize();
+    exit(1);
+  }
+  
+  if(stream_mb > 0) {
+    read_matrix_dims(argv[1], &m, &n, MPI_COMM_WORLD);
+    read_shared_vector(argv[2], (void *) &b, mpitype, &nprime, MPI_COMM_WORLD, &b_seg);
+    sp.b = b;
+    sp.lo = block_low(id, p, m, MPI_COMM_WORLD);
+    sp.c_block = (dtype *)my_malloc(id, block_size(id, p, m, MPI_COMM_WORLD) * sizeof(dtype));
+    stream_row_striped_matrix(argv[1], mpitype, (size_t) (stream_mb * 1e6), multiply_rows, &sp, m, n, &st,
+			      MPI_COMM_WORLD);
+    rate = stream_rate(&st, &wait, MPI_COMM_WORLD);
+    stream_row_striped_matrix(argv[1], mpitype, (size_t) (stream_mb * 1e6), NULL, NULL, m, n, &st,
+			      MPI_COMM_WORLD);
+    raw = stream_rate(&st, &raw_wait, MPI_COMM_WORLD);
+    if(!id) {
+      printf("Streamed %d x %d matrix in %g MB chunks: %.3f GB/s, %.0f%% of the time waiting for reads\n",
+	     m, n, stream_mb, rate, 100 * wait);
+      printf("Read alone: %.3f GB/s; streaming sustains %.0f%% of it\n", raw, 100 * rate / raw);
+    }
+    replicate_block_vector_shared(sp.c_block, m, (void **)&c, mpitype, MPI_COMM_WORLD, &c_seg);
+    print_replicated_vector(c, mpitype, m, MPI_COMM_WORLD);
+    free_shared_segment(&b_seg);
+    free_shared_segment(&c_seg);
+    my_free(sp.c_block);
+    my_finalize();
+    return 0;
+  }
   
   read_row_striped_matrix(argv[1], (void *)&a, (void *)&storage, mpitype, &m, &n, MPI_COMM_WORLD);
-  rows = BLOCK_SIZE(id, p, m);
+  rows = block_size(id, p, m, MPI_COMM_WORLD);
   print_row_striped_matrix((void **)a, mpitype, m, n, MPI_COMM_WORLD);
 
-  read_replicated_vector(argv[2], (void *) &b, mpitype, &nprime, MPI_COMM_WORLD);
+  read_shared_vector(argv[2], (void *) &b, mpitype, &nprime, MPI_COMM_WORLD, &b_seg);
   print_replicated_vector(b, mpitype, nprime, MPI_COMM_WORLD);
   
-  c_block = (dtype *)malloc(rows * sizeof(dtype));
-  c = (dtype *)malloc(n * sizeof(dtype));
+  c_block = (dtype *)my_malloc(id, rows * sizeof(dtype));
   
   for(i = 0; i < rows; i++) {
     c_block[i] = 0.0;
@@ -65,10 +160,12 @@ int main(int argc, char * argv[]) {
       c_block[i] += a[i][j] * b[j];
   }
   
-  replicate_block_vector(c_block, n, (void *)c, mpitype, MPI_COMM_WORLD);
+  replicate_block_vector_shared(c_block, n, (void **)&c, mpitype, MPI_COMM_WORLD, &c_seg);
   
   print_replicated_vector(c, mpitype, n, MPI_COMM_WORLD);
-  MPI_Finalize();
+  free_shared_segment(&b_seg);
+  free_shared_segment(&c_seg);
+  my_finalize();
   return 0;
 }
 
@@ -54,6 +54,7 @@ int main(int argc, char * argv[]) {
   MPI_Init(&argc, &argv);
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
+  init_block_weights(MPI_COMM_WORLD);
   
   read_col_striped_matrix(argv[1], (void ***)&a, (void **)&storage, mpitype, &m, &n, MPI_COMM_WORLD);
   print_col_striped_matrix((void **)a, mpitype, m, n, MPI_COMM_WORLD);
@@ -65,7 +66,7 @@ int main(int argc, char * argv[]) {
    * 'b' resulting in a partial sum of product 'c'
    */
   c_part_out = (dtype *)my_malloc(id, n * sizeof(dtype));
-  local_els = BLOCK_SIZE(id, p, n);
+  local_els = block_size(id, p, n, MPI_COMM_WORLD);
   
   for(i = 0; i < n; i++) {
     c_part_out[i] = 0.0;
@@ -73,11 +74,11 @@ int main(int argc, char * argv[]) {
       c_part_out[i] += a[i][j] * b[j];
   }
   
-  create_mixed_xfer_arrays(id, p, n, &cnt_out, &disp_out);
-  create_uniform_xfer_arrays(id, p, n, &cnt_in, &disp_in);
+  create_mixed_xfer_arrays(id, p, n, MPI_COMM_WORLD, &cnt_out, &disp_out);
+  create_uniform_xfer_arrays(id, p, n, MPI_COMM_WORLD, &cnt_in, &disp_in);
   c_part_in = (dtype *)my_malloc(id, p * local_els * sizeof(dtype));
   
-  MPI_Alltoallv(c_part_out, cnt_out, disp_out, mpitype, c_part_in, cnt_in, disp_in, mpitype, MPI_COMM_WORLD);
+  compressed_alltoallv(c_part_out, cnt_out, disp_out, mpitype, c_part_in, cnt_in, disp_in, MPI_COMM_WORLD);
   
   c = (dtype *)my_malloc(id, local_els * sizeof(dtype));
   for(i = 0; i < local_els; i++) {
@@ -87,7 +88,7 @@ int main(int argc, char * argv[]) {
   }
   
   print_block_vector((void *)c, mpitype, n, MPI_COMM_WORLD);
-  MPI_Finalize();
+  my_finalize();
   
   return 0;
 }
@@ -0,0 +1,252 @@
+
+#ifndef QUADRATURE_MPI
+#define QUADRATURE_MPI
+
+/* Hybrid MPI/OpenMP numerical integration, Version 1
+ *
+ * The integrand is a functor passed by template parameter,
+ * so its call is inlined into the evaluation loops and they
+ * can be vectorized. Work is split across the processes of
+ * a communicator and then across the OpenMP threads of each
+ * process.
+ *
+ * - integrate_midpoint: composite midpoint rule with 'n'
+ *   evaluations (64-bit, so 1e12 is fine). Each process
+ *   takes a block of the evaluation points, its threads
+ *   take chunks of that block, and each chunk is summed by
+ *   an 'omp simd' reduction.
+ * - integrate_adaptive: globally adaptive 15-point
+ *   Gauss-Kronrod. In every round each process evaluates
+ *   its active intervals, intervals whose error estimate
+ *   exceeds their share of the tolerance are bisected, and
+ *   the active intervals are redistributed evenly among the
+ *   processes before the next round.
+ *
+ * C++ only (helpersMPI.h is C), so the block decomposition
+ * is repeated here for 64-bit counts.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <mpi.h>
+#include <math.h>
+#include <vector>
+
+#define QUAD_CHUNK	4096	/* Points per 'omp simd' reduction */
+#define QUAD_MAX_ROUNDS	60	/* Bisection rounds in adaptive mode */
+
+/* What an integration cost */
+struct quad_stats {
+  double evaluations;	/* Integrand evaluations, all processes */
+  double seconds;	/* Elapsed time */
+  double error;		/* Error estimate (adaptive mode) */
+  int rounds;		/* Refinement rounds (adaptive mode) */
+};
+
+inline long long quad_block_low(int id, int p, long long n)
+{
+  return (long long) id * n / p;
+}
+
+inline int quad_block_owner(long long index, int p, long long n)
+{
+  return (int) (((long long) p * (index + 1) - 1) / n);
+}
+
+/*
+ * Integral of 'f' over [a, b] by the midpoint rule with 'n'
+ * points. Every process returns the result
+ */
+template <class F>
+double integrate_midpoint(const F &f, double a, double b, long long n, MPI_Comm comm, quad_stats *st)
+{
+  double global;	/* Sum over all processes */
+  double h;		/* Width of a subinterval */
+  long long hi, lo;	/* This process's points */
+  int id;		/* Process rank */
+  long long nchunks;	/* Chunks in this process's block */
+  int p;		/* Number of processes */
+  double sum;		/* Sum over this process's block */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  st->seconds = -MPI_Wtime();
+
+  h = (b - a) / n;
+  lo = quad_block_low(id, p, n);
+  hi = quad_block_low(id + 1, p, n);
+  nchunks = (hi - lo + QUAD_CHUNK - 1) / QUAD_CHUNK;
+  sum = 0.0;
+
+  /* Summing per chunk keeps the rounding error of 1e12
+   * terms in check
+   */
+#pragma omp parallel for schedule(static) reduction(+:sum)
+  for(long long c = 0; c < nchunks; c++) {
+    long long first = lo + c * QUAD_CHUNK;
+    long long last = first + QUAD_CHUNK < hi ? first + QUAD_CHUNK : hi;
+    double s = 0.0;
+#pragma omp simd reduction(+:s)
+    for(long long i = first; i < last; i++)
+      s += f(a + h * (i + 0.5));
+    sum += s;
+  }
+
+  MPI_Allreduce(&sum, &global, 1, MPI_DOUBLE, MPI_SUM, comm);
+  st->seconds += MPI_Wtime();
+  st->evaluations = (double) n;
+  st->error = 0.0;
+  st->rounds = 1;
+  return global * h;
+}
+
+/*
+ * 15-point Gauss-Kronrod rule on [a, b]: returns the Kronrod
+ * estimate and sets 'err' to its difference from the
+ * embedded 7-point Gauss estimate
+ */
+template <class F>
+double gauss_kronrod15(const F &f, double a, double b, double *err)
+{
+  static const double xgk[8] = {
+    0.991455371120812639206854697526329, 0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926, 0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013, 0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245, 0.0 };
+  static const double wgk[8] = {
+    0.022935322010529224963732008058970, 0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518, 0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550, 0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649, 0.209482141084727828012999174891714 };
+  static const double wg[4] = {
+    0.129484966168869693270611432679082, 0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975, 0.417959183673469387755102040816327 };
+  double c = 0.5 * (a + b);	/* Center */
+  double h = 0.5 * (b - a);	/* Half width */
+  double fc = f(c);
+  double gauss = wg[3] * fc;
+  double kronrod = wgk[7] * fc;
+  int j;
+
+  for(j = 0; j < 7; j++) {
+    double fsum = f(c - h * xgk[j]) + f(c + h * xgk[j]);
+    kronrod += wgk[j] * fsum;
+    if(j & 1) gauss += wg[j / 2] * fsum;
+  }
+  *err = fabs((kronrod - gauss) * h);
+  return kronrod * h;
+}
+
+/*
+ * Integral of 'f' over [a, b] to absolute tolerance 'tol',
+ * starting from 'n' equal intervals. Every process returns
+ * the result
+ */
+template <class F>
+double integrate_adaptive(const F &f, double a, double b, long long n, double tol, MPI_Comm comm, quad_stats *st)
+{
+  std::vector<double> active;	/* Endpoint pairs of active intervals */
+  std::vector<double> next;	/* Active intervals of next round */
+  std::vector<int> cnt_in, cnt_out;	/* Doubles received/sent per process */
+  std::vector<int> disp_in, disp_out;	/* Their displacements */
+  double done;		/* Integral over converged intervals */
+  double done_err;	/* Their error estimates */
+  double evals;		/* Evaluations on this process */
+  long long first;	/* Global index of my first active interval */
+  double global[2];	/* Sums over all processes */
+  int id;		/* Process rank */
+  double local[2];	/* Error, active intervals */
+  long long mine;	/* Active intervals on this process */
+  int p;		/* Number of processes */
+  long long total;	/* Active intervals on all processes */
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  st->seconds = -MPI_Wtime();
+  cnt_in.resize(p);
+  cnt_out.resize(p);
+  disp_in.resize(p);
+  disp_out.resize(p);
+
+  for(long long i = quad_block_low(id, p, n); i < quad_block_low(id + 1, p, n); i++) {
+    active.push_back(a + (b - a) * i / n);
+    active.push_back(i + 1 == n ? b : a + (b - a) * (i + 1) / n);
+  }
+  done = done_err = 0.0;
+  evals = 0.0;
+
+  for(st->rounds = 1; ; st->rounds++) {
+    long long m = active.size() / 2;
+    std::vector<double> value(m), err(m);
+    double pending = 0.0;	/* Integral over unconverged intervals */
+    double pending_err = 0.0;	/* Their error estimates */
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for(long long i = 0; i < m; i++)
+      value[i] = gauss_kronrod15(f, active[2 * i], active[2 * i + 1], &err[i]);
+    evals += 15.0 * m;
+
+    /* Keep intervals within their share of the tolerance,
+     * bisect the others
+     */
+    next.clear();
+    for(long long i = 0; i < m; i++) {
+      double lo = active[2 * i], hi = active[2 * i + 1];
+      if(err[i] <= tol * (hi - lo) / (b - a)) {
+        done += value[i];
+        done_err += err[i];
+        continue;
+      }
+      pending += value[i];
+      pending_err += err[i];
+      next.push_back(lo);
+      next.push_back(0.5 * (lo + hi));
+      next.push_back(0.5 * (lo + hi));
+      next.push_back(hi);
+    }
+
+    /* The estimate covers the converged intervals too */
+    local[0] = done_err + pending_err;
+    local[1] = next.size() / 2;
+    MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, comm);
+    st->error = global[0];
+    if(global[0] <= tol || global[1] == 0.0 || st->rounds == QUAD_MAX_ROUNDS) {
+      done += pending;
+      break;
+    }
+
+    /* Rebalance: the active intervals, in global order, are
+     * dealt out in blocks as if they were one array
+     */
+    total = (long long) global[1];
+    mine = next.size() / 2;
+    MPI_Exscan(&mine, &first, 1, MPI_LONG_LONG, MPI_SUM, comm);
+    if(!id) first = 0;
+    for(int i = 0; i < p; i++) cnt_out[i] = 0;
+    for(long long g = first; g < first + mine; ) {
+      int dest = quad_block_owner(g, p, total);
+      long long end = quad_block_low(dest + 1, p, total);
+      if(end > first + mine) end = first + mine;
+      cnt_out[dest] = 2 * (int) (end - g);
+      g = end;
+    }
+    MPI_Alltoall(&cnt_out[0], 1, MPI_INT, &cnt_in[0], 1, MPI_INT, comm);
+    disp_in[0] = disp_out[0] = 0;
+    for(int i = 1; i < p; i++) {
+      disp_out[i] = disp_out[i - 1] + cnt_out[i - 1];
+      disp_in[i] = disp_in[i - 1] + cnt_in[i - 1];
+    }
+    active.resize(disp_in[p - 1] + cnt_in[p - 1]);
+    MPI_Alltoallv(next.empty() ? NULL : &next[0], &cnt_out[0], &disp_out[0], MPI_DOUBLE,
+                  active.empty() ? NULL : &active[0], &cnt_in[0], &disp_in[0], MPI_DOUBLE, comm);
+  }
+
+  local[0] = done;
+  local[1] = evals;
+  MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, comm);
+  st->seconds += MPI_Wtime();
+  st->evaluations = global[1];
+  return global[0];
+}
+
+#endif
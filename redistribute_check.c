@@ -0,0 +1,116 @@
+/* Redistribution check, Version 1
+ *
+ * Fills an m x n matrix of doubles, element (i, j) being
+ * i * n + j, in each of the row-striped, column-striped and
+ * checkerboard layouts, and round-trips it through every
+ * layout with 'redistribute_matrix': once to the target
+ * layout, plain and transposed, checking every element of
+ * the new block, and once back to where it started,
+ * checking that the original block comes back unchanged.
+ * The processes form a Cartesian grid, as the checkerboard
+ * layout needs; row and column blocks are split over its
+ * ranks. Run it on several process counts, including ones
+ * that do not divide the matrix.
+ *
+ * Usage: redistribute_check [rows cols]
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <mpi.h>
+#include "helpersMPI.h"
+
+#define ROWS	37
+#define COLS	53
+
+char *layout_name[] = {"rows", "cols", "checkerboard"};
+
+/*
+ * Elements of this process's block of the 'm' x 'n' matrix in
+ * 'layout' that are not i * n + j ('transpose': the block of
+ * the transpose, whose element (i, j) is j * n + i)
+ */
+long check_block(
+  double *a,		/* IN - Block, row by row */
+  int layout,		/* IN - LAYOUT_... */
+  int m,		/* IN - Rows of the original */
+  int n,		/* IN - Cols of the original */
+  int transpose,	/* IN - 'a' is a block of the transpose */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  long long r0, c0;	/* First row and column of the block */
+  int rows, cols;	/* Its size */
+  long bad = 0;
+  int i, j, id;
+
+  MPI_Comm_rank(comm, &id);
+  if(transpose) layout_block(layout, id, n, m, comm, &r0, &rows, &c0, &cols);
+  else layout_block(layout, id, m, n, comm, &r0, &rows, &c0, &cols);
+  for(i = 0; i < rows; i++)
+    for(j = 0; j < cols; j++)
+      if(a[(size_t) i * cols + j] != (transpose ? (c0 + j) * n + r0 + i : (r0 + i) * n + c0 + j)) bad++;
+  return bad;
+}
+
+int main(int argc, char *argv[])
+{
+  MPI_Comm grid;	/* Cartesian communicator */
+  int dims[2] = {0, 0};
+  int periods[2] = {0, 0};
+  void **a, **b, **c;	/* Row pointers: original, moved, back */
+  double *sa, *sb, *sc;	/* Their elements */
+  long long r0, c0;
+  long bad[2];		/* Wrong elements: moved, back */
+  long all_bad[2];
+  int failed = 0;
+  int from, to, transpose;
+  int rows, cols, i, j;
+  int id, p, m = ROWS, n = COLS;
+
+  MPI_Init(&argc, &argv);
+  MPI_Comm_size(MPI_COMM_WORLD, &p);
+  if(argc > 2 && atoi(argv[1]) > 0 && atoi(argv[2]) > 0) {
+    m = atoi(argv[1]);
+    n = atoi(argv[2]);
+  }
+  MPI_Dims_create(p, 2, dims);
+  MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 0, &grid);
+  MPI_Comm_rank(grid, &id);
+  if(!id) {
+    printf("%d x %d matrix, %d processes on a %d x %d grid\n", m, n, p, dims[0], dims[1]);
+    printf("%-13s %-13s %-9s %10s %10s\n", "From", "To", "Transpose", "Moved", "Back");
+  }
+
+  for(from = LAYOUT_ROWS; from <= LAYOUT_CHECKERBOARD; from++) {
+    layout_block(from, id, m, n, grid, &r0, &rows, &c0, &cols);
+    sa = alloc_matrix_block(id, rows, cols, sizeof(double), &a);
+    for(i = 0; i < rows; i++)
+      for(j = 0; j < cols; j++) sa[(size_t) i * cols + j] = (r0 + i) * n + c0 + j;
+
+    for(to = LAYOUT_ROWS; to <= LAYOUT_CHECKERBOARD; to++)
+      for(transpose = 0; transpose < 2; transpose++) {
+	redistribute_matrix(sa, from, m, n, to, transpose, MPI_DOUBLE, &b, (void **) &sb, grid);
+	bad[0] = check_block(sb, to, m, n, transpose, grid);
+	if(transpose)
+	  redistribute_matrix(sb, to, n, m, from, 1, MPI_DOUBLE, &c, (void **) &sc, grid);
+	else redistribute_matrix(sb, to, m, n, from, 0, MPI_DOUBLE, &c, (void **) &sc, grid);
+	bad[1] = check_block(sc, from, m, n, 0, grid);
+	MPI_Reduce(bad, all_bad, 2, MPI_LONG, MPI_SUM, 0, grid);
+	if(!id) {
+	  printf("%-13s %-13s %-9s %10s %10s\n", layout_name[from], layout_name[to], transpose ? "yes" : "no",
+		 all_bad[0] ? "FAILED" : "ok", all_bad[1] ? "FAILED" : "ok");
+	  if(all_bad[0] || all_bad[1]) failed++;
+	}
+	my_free(sb);
+	my_free(sc);
+      }
+    my_free(sa);
+  }
+
+  if(!id) printf("%s\n", failed ? "FAILED" : "OK");
+  MPI_Comm_free(&grid);
+  my_finalize();
+  return 0;
+}
@@ -1,5 +1,10 @@
-
-/* The Sieve or Eratosthenes, Version 1
+/* The Sieve of Eratosthenes, Version 2
+ * 
+ * Counts the primes up to n. Version 2 stamps the small
+ * primes with a wheel presieve, sieves in cache-sized windows
+ * on the OpenMP threads of each process, can keep the primes
+ * found in a cache file for later runs, and can count with
+ * Meissel-Lehmer (LMO) instead of sieving to n.
  * 
  * The sequential algorithm is as follows:
  * 1. Create a list of natural numbers 2, 3, 4, ..., n none of which is marked
@@ -13,7 +18,7 @@
  * 
  * Author: Michael Quinn
  * 
- * Last modification: 12 May 2016
+ * Last modification: 18 October 2026
  * 
  * Time complexity:
  * X(n ln ln n)/p + (sqrt(n)/ln sqrt(n))l[log p]
@@ -26,31 +31,732 @@
  * [log p] 		- ceiling of log p
  * n/ln n 		- the number of primes between 2 and n
  * sqrt(n)/ln sqrt(n) 	- approximation to the number of loop iterations
+ * 
+ * Presieve: the multiples of 2, 3, 5, 7, 11 and 13 repeat
+ * with period 2 * 3 * 5 * 7 * 11 * 13 = 30030, so each
+ * window is stamped with that precomputed pattern at the
+ * phase of its first value instead of marking them one by
+ * one; the per-prime marking starts at 17
+ *
+ * Threads: every process finds the sieving primes up to
+ * sqrt(n) itself, then its OpenMP threads split its block
+ * of [2, n] into equal parts. A thread sieves its part one
+ * cache-sized window of odd numbers at a time, carrying the
+ * next multiple of each sieving prime from window to window,
+ * so only WINDOW bytes per thread are ever allocated. Thread
+ * counts are summed in the process before the MPI_Reduce.
+ * One process per socket (or node) with a thread per core
+ * keeps a single copy of the sieving primes there.
+ *
+ * Cache: with '-cache file' the primes found are kept in a
+ * file, one bit per odd number (1 for a prime), in records
+ * of CACHE_BLOCK odd numbers, each led by the count of odd
+ * primes before it. A run maps the file read-only (shared
+ * with every other process mapping it) and answers a
+ * count it covers with one index lookup and at most
+ * CACHE_WORDS popcounts; otherwise the processes sieve only
+ * the uncovered blocks, append them with MPI-IO and update
+ * the header. A lock on the file keeps concurrent runs from
+ * extending it twice.
+ *
+ * Counting without sieving to n: '-lmo' finds pi(n) by the
+ * Lagarias-Miller-Odlyzko form of Meissel-Lehmer, in about
+ * n^(2/3) operations. With y = cbrt(n) and a = pi(y),
+ *   pi(n) = phi(n, a) + a - 1 - P2(n, y)
+ * phi(n, a) = S1 + S2: the ordinary leaves mu(m) * n/m for
+ * m <= y, and the special leaves -mu(m) * phi(n/(p_b m), b-1)
+ * for y/p_b < m <= y with lpf(m) > p_b. The special leaves
+ * are read off a bit-packed sieve of [1, n/y] that crosses
+ * off one prime at a time; P2 counts the primes up to n/p,
+ * for the primes p in (y, sqrt(n)], with the odd window
+ * sieve. Both sieves are cut into ranges, one per thread of
+ * each process. A range starts its phi(., b) and prime
+ * counts at 0 and keeps how many leaves used each, so the
+ * counts of the ranges below it (a sum over the threads,
+ * then an MPI_Exscan) fix it up afterwards. '-check' also
+ * sieves and compares.
+ *
+ * Usage: sieve_of_eratosthenes <n> [-cache file] [-lmo | -check]
  */
 
 #include <mpi.h>
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "helpersMPI.h"
 
+#define WHEEL		30030	/* 2 * 3 * 5 * 7 * 11 * 13 */
+#define WHEEL_ODD	(WHEEL / 2)	/* Period counted in odd numbers */
+#define WHEEL_NEXT	17	/* First prime left to mark */
+#define WINDOW		(128 * 1024)	/* Odd numbers per window; fits L2 */
+
+#define SEGMENT		(256 * 1024)	/* Values per special-leaf segment */
+
+#define CACHE_MAGIC	"PRIMEODD"
+#define CACHE_BLOCK	65536		/* Odd numbers per cache record */
+#define CACHE_WORDS	(CACHE_BLOCK / 64)
+#define CACHE_RECORD	(8 + CACHE_BLOCK / 8)	/* Count before, then bits */
+#define CACHE_HEADER	4096		/* Bytes before the first record */
+
+/* Start of a cache file */
+typedef struct {
+  char magic[8];	/* CACHE_MAGIC */
+  long long blocks;	/* Records: odd numbers 1 .. 2 * blocks * CACHE_BLOCK - 1 */
+  long long odd_primes;	/* Odd primes in them */
+  long long block;	/* CACHE_BLOCK of the writer */
+} cache_header;
+
+int wheel_primes[] = { 3, 5, 7, 11, 13 };	/* 2 is left out with the even numbers */
+
+/*
+ * Pattern of the wheel over odd numbers: pattern[k] is 1
+ * when 2k + 1 is a multiple of an odd wheel prime
+ */
+char *wheel_pattern(void)
+{
+  char *pattern = (char *) malloc(WHEEL_ODD);
+  int j, k;
+
+  if(pattern == NULL) return NULL;
+  for(k = 0; k < WHEEL_ODD; k++) {
+    pattern[k] = 0;
+    for(j = 0; j < 5; j++)
+      if(!((2 * k + 1) % wheel_primes[j])) pattern[k] = 1;
+  }
+  return pattern;
+}
+
+/*
+ * Mark the multiples of the wheel primes in 'marked', whose
+ * element k stands for odd number 'low_value' + 2k, by
+ * copying the pattern from the matching phase; the wheel
+ * primes themselves stay unmarked
+ */
+void presieve(char *marked, int size, long long low_value, char *pattern)
+{
+  int phase = (int) (low_value % WHEEL) / 2;
+  int done, chunk, j;
+
+  done = MIN(size, WHEEL_ODD - phase);
+  memcpy(marked, pattern + phase, done);
+  for(; done < size; done += chunk) {
+    chunk = MIN(WHEEL_ODD, size - done);
+    memcpy(marked + done, pattern, chunk);
+  }
+  for(j = 0; j < 5; j++)
+    if(wheel_primes[j] >= low_value && (wheel_primes[j] - low_value) / 2 < size)
+      marked[(wheel_primes[j] - low_value) / 2] = 0;
+}
+
+/*
+ * Primes from WHEEL_NEXT up to 'limit', by a plain sieve;
+ * returns how many, in '*primes'
+ */
+int sieving_primes(int limit, int **primes)
+{
+  char *composite;
+  int count = 0, i, j;
+
+  *primes = (int *) malloc((limit / 2 + 1) * sizeof(int));
+  composite = (char *) calloc(limit + 1, 1);
+  for(i = 2; i <= limit; i++) {
+    if(composite[i]) continue;
+    if(i >= WHEEL_NEXT) (*primes)[count++] = i;
+    if(i <= limit / i)
+      for(j = i * i; j <= limit; j += i) composite[j] = 1;
+  }
+  free(composite);
+  return count;
+}
+
+/*
+ * Count the primes among the odd numbers 'first',
+ * 'first' + 2, ..., 'first' + 2 * ('m' - 1), one window at
+ * a time. With 'bits' (zeroed) the primes are also set
+ * there, bit k for 'first' + 2k
+ */
+long long sieve_odd_range(
+  long long first,	/* IN - First odd number */
+  long long m,		/* IN - How many odd numbers */
+  int *primes,		/* IN - Sieving primes from 17 */
+  int nprimes,		/* IN - How many */
+  char *pattern,	/* IN - Wheel pattern */
+  char *window,		/* IN - WINDOW bytes of work space */
+  uint64_t *bits)	/* OUT - Primes found, or NULL */
+{
+  long long *next;	/* Index of each prime's next odd multiple */
+  long long w, k, q, start, count = 0;
+  int j, size;
+
+  next = (long long *) malloc((nprimes + 1) * sizeof(long long));
+  for(j = 0; j < nprimes; j++) {
+    q = primes[j];
+    start = q * q;
+    if(start < first) {
+      start = (first + q - 1) / q * q;
+      if(!(start & 1)) start += q;
+    }
+    next[j] = (start - first) / 2;
+  }
+
+  for(w = 0; w < m; w += WINDOW) {
+    size = (int) MIN(WINDOW, m - w);
+    presieve(window, size, first + 2 * w, pattern);
+    for(j = 0; j < nprimes; j++) {
+      q = primes[j];
+      for(k = next[j] - w; k < size; k += q) window[k] = 1;
+      next[j] = w + k;
+    }
+    for(k = 0; k < size; k++)
+      if(!window[k]) {
+	count++;
+	if(bits != NULL) bits[(w + k) >> 6] |= (uint64_t) 1 << ((w + k) & 63);
+      }
+  }
+  free(next);
+  return count;
+}
+
+/*
+ * Split the odd numbers 'first' ... 'first' + 2 * ('m' - 1)
+ * among the threads and return their primes. With 'bits'
+ * the parts start on 64-bit words, so no two threads set
+ * bits in the same word
+ */
+long long sieve_threads(
+  long long first,	/* IN - First odd number */
+  long long m,		/* IN - How many odd numbers */
+  int *primes,		/* IN - Sieving primes from 17 */
+  int nprimes,		/* IN - How many */
+  char *pattern,	/* IN - Wheel pattern */
+  uint64_t *bits,	/* OUT - Primes found, or NULL */
+  int *threads)		/* OUT - Threads used */
+{
+  long long count = 0;
+
+#pragma omp parallel reduction(+:count)
+  {
+    int t = 0, nt = 1;
+    long long lo, hi;	/* This thread's odd values, as indices */
+    char *window = (char *) malloc(WINDOW);
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+    nt = omp_get_num_threads();
+#endif
+    if(!t) *threads = nt;
+    lo = m * t / nt;
+    hi = m * (t + 1) / nt;
+    if(bits != NULL) {
+      lo &= ~63LL;
+      if(t < nt - 1) hi &= ~63LL;
+    }
+    if(window == NULL) {
+      printf("Cannot allocate enough memory\n");
+      MPI_Abort(MPI_COMM_WORLD, MALLOC_ERROR);
+    }
+    if(hi > lo)
+      count += sieve_odd_range(first + 2 * lo, hi - lo, primes, nprimes, pattern, window,
+			       bits != NULL ? bits + (lo >> 6) : NULL);
+    free(window);
+  }
+  return count;
+}
+
+int popcount64(uint64_t x)
+{
+#ifdef __GNUC__
+  return __builtin_popcountll(x);
+#else
+  int c = 0;
+  for(; x; x &= x - 1) c++;
+  return c;
+#endif
+}
+
+/*
+ * Open (creating it if needed) and lock a cache file, and
+ * read its header. Returns the descriptor, -1 if the file
+ * cannot be used
+ */
+int open_cache(const char *name, int lock, cache_header *h)
+{
+  int fd;
+
+  if((fd = open(name, O_RDWR | O_CREAT, 0644)) < 0) return -1;
+  flock(fd, lock);
+  if(pread(fd, h, sizeof(cache_header), 0) != sizeof(cache_header)) {
+    if(lseek(fd, 0, SEEK_END) > 0) {	/* Not ours */
+      close(fd);
+      return -1;
+    }
+    memcpy(h->magic, CACHE_MAGIC, 8);
+    h->blocks = 0;
+    h->odd_primes = 0;
+    h->block = CACHE_BLOCK;
+  } else if(memcmp(h->magic, CACHE_MAGIC, 8) || h->block != CACHE_BLOCK) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Odd primes among the first 'k' odd numbers of a mapped
+ * cache: the count before k's record plus the popcount of
+ * the bits below k in it
+ */
+long long cache_query(const char *map, cache_header *h, long long k)
+{
+  const char *rec;
+  const uint64_t *words;
+  long long count;
+  int r, w;
+
+  if(k >= h->blocks * CACHE_BLOCK) return h->odd_primes;
+  rec = map + CACHE_HEADER + (k / CACHE_BLOCK) * (long long) CACHE_RECORD;
+  memcpy(&count, rec, 8);
+  words = (const uint64_t *) (rec + 8);
+  r = (int) (k % CACHE_BLOCK);
+  for(w = 0; w < r / 64; w++) count += popcount64(words[w]);
+  if(r % 64) count += popcount64(words[r / 64] & (((uint64_t) 1 << (r % 64)) - 1));
+  return count;
+}
+
+/*
+ * Count the primes up to 'n' with the cache file 'name':
+ * answered from the file when it covers 'n', otherwise by
+ * sieving the uncovered blocks, which are then appended.
+ * The count is returned on process 0.
+ *
+ * All processes must invoke this function together
+ */
+long long count_with_cache(
+  long long n,		/* IN - Upper limit */
+  const char *name,	/* IN - Cache file */
+  int *primes,		/* IN - Sieving primes from 17 */
+  int nprimes,		/* IN - How many */
+  char *pattern,	/* IN - Wheel pattern */
+  int *threads,		/* OUT - Threads per process */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  cache_header h;
+  int fd = -1, id, p;
+  long long k = n >= 1 ? (n + 1) / 2 : 0;	/* Odd numbers up to n */
+  long long b1;		/* Blocks covered after this run */
+  long long lo, nb;	/* This process's new blocks */
+  long long found;	/* Odd primes in them */
+  long long tail = 0;	/* Odd primes after the last whole block */
+  long long before;	/* Odd primes before this process's blocks */
+  long long added;	/* Odd primes in all new blocks */
+  long long count = 0, b, total;
+  uint64_t *bits;
+  char *records, *map;
+  MPI_Datatype record;
+  MPI_File f;
+  double t;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  *threads = 1;
+  if(!id) {
+    fd = open_cache(name, LOCK_SH, &h);
+    if(fd >= 0 && k > h.blocks * CACHE_BLOCK) {	/* Extending: lock out other runs */
+      close(fd);
+      fd = open_cache(name, LOCK_EX, &h);
+    }
+    if(fd < 0) h.blocks = -1;
+  }
+  MPI_Bcast(&h, sizeof(cache_header), MPI_BYTE, 0, comm);
+  if(h.blocks < 0) {
+    if(!id) printf("Cannot use %s as a prime cache\n", name);
+    MPI_Abort(comm, OPEN_FILE_ERROR);
+  }
+
+  if(k <= h.blocks * CACHE_BLOCK) {
+    if(!id) {
+      map = mmap(NULL, CACHE_HEADER + h.blocks * CACHE_RECORD, PROT_READ, MAP_SHARED, fd, 0);
+      t = MPI_Wtime();
+      count = cache_query(map, &h, k) + (n >= 2);
+      t = MPI_Wtime() - t;
+      munmap(map, CACHE_HEADER + h.blocks * CACHE_RECORD);
+      close(fd);
+      printf("Answered from the cache in %.2f us\n", t * 1e6);
+    }
+    return count;
+  }
+
+  /* Sieve the new whole blocks, by process; the rest only counts */
+  b1 = k / CACHE_BLOCK;
+  lo = h.blocks + BLOCK_LOW(id, p, b1 - h.blocks);
+  nb = BLOCK_SIZE(id, p, b1 - h.blocks);
+  bits = (uint64_t *) calloc(nb * CACHE_WORDS + 1, sizeof(uint64_t));
+  found = nb ? sieve_threads(2 * lo * CACHE_BLOCK + 1, nb * CACHE_BLOCK, primes, nprimes, pattern, bits, threads) : 0;
+  if(nb && !lo) {	/* 1 is not prime */
+    bits[0] &= ~(uint64_t) 1;
+    found--;
+  }
+  if(id == p - 1 && k > b1 * CACHE_BLOCK) {
+    tail = sieve_threads(2 * b1 * CACHE_BLOCK + 1, k - b1 * CACHE_BLOCK, primes, nprimes, pattern, NULL, threads);
+    if(!b1) tail--;
+  }
+
+  /* Records: each block's bits led by the odd primes before it */
+  before = 0;
+  MPI_Exscan(&found, &before, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  if(!id) before = 0;
+  before += h.odd_primes;
+  records = (char *) malloc(nb * CACHE_RECORD + 1);
+  for(b = 0; b < nb; b++) {
+    memcpy(records + b * CACHE_RECORD, &before, 8);
+    memcpy(records + b * CACHE_RECORD + 8, bits + b * CACHE_WORDS, CACHE_BLOCK / 8);
+    for(total = 0; total < CACHE_WORDS; total++) before += popcount64(bits[b * CACHE_WORDS + total]);
+  }
+  free(bits);
+  MPI_Type_contiguous(CACHE_RECORD, MPI_BYTE, &record);
+  MPI_Type_commit(&record);
+  MPI_File_open(comm, (char *) name, MPI_MODE_WRONLY, MPI_INFO_NULL, &f);
+  MPI_File_write_at_all(f, CACHE_HEADER + lo * CACHE_RECORD, records, (int) nb, record, MPI_STATUS_IGNORE);
+  MPI_File_close(&f);
+  MPI_Type_free(&record);
+  free(records);
+
+  MPI_Allreduce(&found, &added, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  found += tail;
+  MPI_Reduce(&found, &count, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+  if(!id) {
+    if(b1 > h.blocks)
+      printf("Cache extended from n < %lld to n < %lld\n", 2 * h.blocks * CACHE_BLOCK, 2 * b1 * CACHE_BLOCK);
+    count += h.odd_primes + (n >= 2);
+    h.blocks = b1;
+    h.odd_primes += added;
+    if(pwrite(fd, &h, sizeof(cache_header), 0) != sizeof(cache_header))
+      printf("Cannot update the header of %s\n", name);
+    close(fd);
+  }
+  return count;
+}
+
+/*
+ * All the primes up to 'limit', from (*primes)[1] = 2;
+ * returns how many
+ */
+int prime_table(int limit, int **primes)
+{
+  char *composite;
+  int count = 0, i, j;
+
+  *primes = (int *) malloc((limit / 2 + 2) * sizeof(int));
+  composite = (char *) calloc(limit + 1, 1);
+  (*primes)[0] = 1;
+  for(i = 2; i <= limit; i++) {
+    if(composite[i]) continue;
+    (*primes)[++count] = i;
+    if(i <= limit / i)
+      for(j = i * i; j <= limit; j += i) composite[j] = 1;
+  }
+  free(composite);
+  return count;
+}
+
+/*
+ * Least prime factor and Moebius function of 1, ..., 'y';
+ * lpf[1] is above every prime
+ */
+void lpf_moebius(int y, int *lpf, signed char *mu)
+{
+  int i, j;
+
+  for(i = 1; i <= y; i++) {
+    lpf[i] = 0;
+    mu[i] = 1;
+  }
+  lpf[1] = INT_MAX;
+  for(i = 2; i <= y; i++)
+    if(!lpf[i])
+      for(j = i; j <= y; j += i) {
+	if(!lpf[j]) lpf[j] = i;
+	mu[j] = (j / i) % i ? -mu[j] : 0;
+      }
+}
+
+/*
+ * floor of the square ('k' = 2) or cube ('k' = 3) root
+ */
+long long integer_root(long long x, int k)
+{
+  long long r = (long long) pow((double) x, 1.0 / k);
+
+  while(r > 0 && (k == 2 ? r * r : r * r * r) > x) r--;
+  while((k == 2 ? (r + 1) * (r + 1) : (r + 1) * (r + 1) * (r + 1)) <= x) r++;
+  return r;
+}
+
+/*
+ * Special leaves with n = x/(p_b m) in ['lo', 'hi'), counting
+ * phi(n, b-1) from 'lo' on. phi[b] ends as the values of the
+ * range left after crossing off p_1, ..., p_(b-1), and
+ * coef[b] as the sum of -mu(m) over the leaves of b: the
+ * factor of the phi(lo - 1, b-1) the range leaves out
+ */
+long long special_leaves(
+  long long x,		/* IN - Upper limit */
+  long long y,		/* IN - Leaves up to here */
+  long long lo,		/* IN - First value */
+  long long hi,		/* IN - Past the last */
+  int *primes,		/* IN - From primes[1] = 2 */
+  int pi_y,		/* IN - Primes up to y */
+  int *lpf,		/* IN - Least prime factors to y */
+  signed char *mu,	/* IN - Moebius function to y */
+  long long *phi,	/* OUT - Values left, by b */
+  long long *coef)	/* OUT - Leaves, by b */
+{
+  uint64_t *sieve = (uint64_t *) malloc(SEGMENT / 8);
+  long long s2 = 0, low, high, m, min_m, max_m, i, j, p, count;
+  int b, w, words;
+
+  if(sieve == NULL) {
+    printf("Cannot allocate enough memory\n");
+    MPI_Abort(MPI_COMM_WORLD, MALLOC_ERROR);
+  }
+  for(low = lo; low < hi; low += SEGMENT) {
+    high = MIN(low + SEGMENT, hi);
+    words = (int) ((high - low + 63) / 64);
+    memset(sieve, 0xff, words * sizeof(uint64_t));
+    if((high - low) & 63) sieve[words - 1] = ((uint64_t) 1 << ((high - low) & 63)) - 1;
+    for(b = 1; b < pi_y; b++) {
+      p = primes[b];
+      if(x / (p * p) < low) break;	/* No leaves of b here or above */
+
+      /* Leaves in the segment; n grows as m falls */
+      min_m = MAX(x / (p * high), y / p);
+      max_m = MIN(x / (p * low), y);
+      for(w = 0, count = 0, m = max_m; m > min_m; m--)
+	if(mu[m] && lpf[m] > p) {
+	  i = x / (p * m) - low;
+	  while(w < (i >> 6)) count += popcount64(sieve[w++]);
+	  s2 -= mu[m] * (phi[b] + count + popcount64(sieve[w] & ((2ULL << (i & 63)) - 1)));
+	  coef[b] -= mu[m];
+	}
+      for(w = 0; w < words; w++) phi[b] += popcount64(sieve[w]);
+
+      /* Then cross off p_b, p_b itself included */
+      for(j = MAX(p, (low + p - 1) / p * p); j < high; j += p)
+	sieve[(j - low) >> 6] &= ~((uint64_t) 1 << ((j - low) & 63));
+    }
+  }
+  free(sieve);
+  return s2;
+}
+
+/*
+ * For the primes p in (y, sqrt(x)] with x/p in ['lo', 'hi'):
+ * the sum over them of the primes in [lo, x/p]. How many p
+ * go to '*leaves', the primes of the range to '*count'
+ */
+long long p2_range(
+  long long x,		/* IN - Upper limit */
+  long long y,		/* IN - Lower bound on p */
+  long long lo,		/* IN - First value */
+  long long hi,		/* IN - Past the last */
+  int *primes,		/* IN - From primes[1] = 2 */
+  int pi_sqrt,		/* IN - Primes up to sqrt(x) */
+  char *pattern,	/* IN - Wheel pattern */
+  long long *count,	/* OUT - Primes in [lo, hi) */
+  long long *leaves)	/* OUT - How many p */
+{
+  uint64_t *bits = (uint64_t *) malloc(WINDOW / 8);
+  char *window = (char *) malloc(WINDOW);
+  long long sum = 0, total = 0, run, wlo, whi, first, m, n, i, found;
+  int k = pi_sqrt, ns, w, two;
+
+  if(bits == NULL || window == NULL) {
+    printf("Cannot allocate enough memory\n");
+    MPI_Abort(MPI_COMM_WORLD, MALLOC_ERROR);
+  }
+  /* Sieving primes from 17 = primes[7] */
+  for(ns = 0; 7 + ns <= pi_sqrt && (long long) primes[7 + ns] * primes[7 + ns] < hi; ns++);
+  while(k > 0 && primes[k] > y && x / primes[k] < lo) k--;
+  *leaves = 0;
+  for(wlo = lo; wlo < hi; wlo += 2 * WINDOW) {
+    whi = MIN(wlo + 2 * WINDOW, hi);
+    first = wlo | 1;
+    m = whi > first ? (whi - first + 1) / 2 : 0;
+    memset(bits, 0, WINDOW / 8);
+    found = m ? sieve_odd_range(first, m, primes + 7, ns, pattern, window, bits) : 0;
+    if(first == 1 && m) {	/* 1 is not prime */
+      bits[0] &= ~(uint64_t) 1;
+      found--;
+    }
+    two = wlo <= 2 && whi > 2;
+
+    /* n = x/p grows as p falls; n >= 2 */
+    for(run = total + two, w = 0; k > 0 && primes[k] > y && (n = x / primes[k]) < whi; k--) {
+      if(n >= first) {
+	i = (n - first) / 2;
+	while(w < (i >> 6)) run += popcount64(bits[w++]);
+	sum += run + popcount64(bits[w] & ((2ULL << (i & 63)) - 1));
+      } else sum += run;
+      (*leaves)++;
+    }
+    total += found + two;
+  }
+  free(bits);
+  free(window);
+  *count = total;
+  return sum;
+}
+
+/*
+ * Start of the k-th of 'parts' ranges of [lo, hi): growing
+ * as (k/parts)^2 when 'square' (the special leaves thin out
+ * as 1/sqrt(n)), evenly otherwise
+ */
+long long part_low(long long lo, long long hi, int k, int parts, int square)
+{
+  double f = (double) k / parts;
+
+  if(k >= parts) return hi;
+  return lo + (long long) ((hi - lo) * (square ? f * f : f));
+}
+
+/*
+ * pi(x) by Lagarias-Miller-Odlyzko; the count is returned
+ * on process 0.
+ *
+ * All processes must invoke this function together
+ */
+long long prime_count_lmo(
+  long long x,		/* IN - Upper limit */
+  char *pattern,	/* IN - Wheel pattern */
+  int *threads,		/* OUT - Threads per process */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  long long y = integer_root(x, 3);
+  long long sq = integer_root(x, 2);
+  long long z = y ? x / y : 0;	/* Largest special leaf */
+  int *primes, *lpf, pi_y, pi_sqrt, pi_below, id, p, nt, t, b;
+  signed char *mu;
+  long long **phi;	/* By thread: phi[t][b], then coef[t][b] */
+  long long *s2, *sum, *cnt, *np;	/* By thread */
+  long long *local;	/* Values left by b, then primes of P2 */
+  long long *below;	/* The same for the processes before */
+  long long *coef;	/* Leaves by b, of this process */
+  long long part[3], all[3];	/* S2, sum of pi(x/p), p */
+  long long result = 0;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  if(x < 2) return 0;	/* No primes; the formula below gives -1 */
+  pi_sqrt = prime_table((int) sq, &primes);
+  for(pi_y = 0; pi_y < pi_sqrt && primes[pi_y + 1] <= y; pi_y++);
+  for(pi_below = 0; pi_below < pi_sqrt && primes[pi_below + 1] < sq; pi_below++);
+  lpf = (int *) malloc((y + 1) * sizeof(int));
+  mu = (signed char *) malloc(y + 1);
+  lpf_moebius((int) y, lpf, mu);
+
+  nt = 1;
+#ifdef _OPENMP
+  nt = omp_get_max_threads();
+#endif
+  phi = (long long **) malloc(nt * sizeof(long long *));
+  s2 = (long long *) malloc(4 * nt * sizeof(long long));
+  sum = s2 + nt;
+  cnt = sum + nt;
+  np = cnt + nt;
+
+  /* Thread t of process id takes range id * nt + t of each sieve */
+#pragma omp parallel num_threads(nt)
+  {
+    int t = 0, k;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    k = id * nt + t;
+    phi[t] = (long long *) calloc(2 * (pi_y + 1), sizeof(long long));
+    s2[t] = special_leaves(x, y, part_low(1, z + 1, k, p * nt, 1), part_low(1, z + 1, k + 1, p * nt, 1),
+			   primes, pi_y, lpf, mu, phi[t], phi[t] + pi_y + 1);
+    sum[t] = p2_range(x, y, part_low(sq, z + 1, k, p * nt, 0), part_low(sq, z + 1, k + 1, p * nt, 0),
+		      primes, pi_sqrt, pattern, &cnt[t], &np[t]);
+  }
+  *threads = nt;
+
+  /* Fix up each thread with the counts of the threads before it */
+  local = (long long *) calloc(3 * (pi_y + 2), sizeof(long long));
+  below = local + pi_y + 2;
+  coef = below + pi_y + 2;
+  part[0] = part[1] = part[2] = 0;
+  for(t = 0; t < nt; t++) {
+    part[0] += s2[t];
+    part[1] += sum[t] + np[t] * local[pi_y + 1];
+    part[2] += np[t];
+    for(b = 1; b < pi_y; b++) {
+      part[0] += phi[t][pi_y + 1 + b] * local[b];
+      coef[b] += phi[t][pi_y + 1 + b];
+      local[b] += phi[t][b];
+    }
+    local[pi_y + 1] += cnt[t];
+    free(phi[t]);
+  }
+
+  /* ... and each process with those of the processes before it */
+  MPI_Exscan(local, below, pi_y + 2, MPI_LONG_LONG, MPI_SUM, comm);
+  if(id) {
+    for(b = 1; b < pi_y; b++) part[0] += coef[b] * below[b];
+    part[1] += part[2] * below[pi_y + 1];
+  }
+  MPI_Reduce(part, all, 3, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+  if(!id) {
+    /* phi(x, a) = S1 + S2 */
+    for(b = 1; b <= y; b++) result += mu[b] * (x / b);
+    result += all[0] + pi_y - 1;
+
+    /* P2 = sum over p_b in (y, sqrt(x)] of pi(x/p_b) - (b - 1) */
+    result -= all[1] + all[2] * pi_below;
+    for(b = pi_y + 1; b <= pi_sqrt; b++) result += b - 1;
+  }
+  free(local);
+  free(s2);
+  free(phi);
+  free(mu);
+  free(lpf);
+  free(primes);
+  return result;
+}
+
 int main(int argc, char * argv[]) {
 
-  int count;		/* local prime count */
+  long long count;	/* local prime count */
   double elapsed_time;	/* parallel execution time */
-  int first;		/* index of first multiple */
-  int global_count;	/* global prime count */
-  int high_value;	/* highest value on this proc */
-  int i;		/* loop counter */
+  long long first;	/* first odd value on this proc */
+  long long global_count;	/* global prime count */
+  long long high_value;	/* highest value on this proc */
   int id;		/* process id number */
-  int index;		/* index of current prime */
-  int low_value;	/* lowest value on this proc */
-  char * marked;	/* portion of 2,...,'n' */
-  int n;		/* sieving from 2,..., 'n' */
+  long long low_value;	/* lowest value on this proc */
+  long long m;		/* odd values on this proc */
+  long long n;		/* sieving from 2,..., 'n' */
+  int nprimes;		/* sieving primes */
   int p;		/* number of processes */
-  int proc0_size;	/* size of proc 0's subarray */
-  int prime;		/* current prime */
-  int size;		/* elements in 'marked' */
+  char * pattern;	/* wheel presieve pattern */
+  int * primes;		/* sieving primes from 17 to sqrt(n) */
+  int root;		/* floor(sqrt(n)) */
+  int threads = 1;	/* threads per process */
+  char * cache = NULL;	/* prime cache file */
+  int lmo = 0;		/* count by Meissel-Lehmer */
+  int check = 0;	/* ... and by the sieve */
+  long long lmo_count = 0;	/* Meissel-Lehmer count */
+  double lmo_time;	/* its time */
+  int i;
   
   MPI_Init(&argc, &argv);
   
@@ -61,13 +767,18 @@ int main(int argc, char * argv[]) {
   MPI_Comm_rank(MPI_COMM_WORLD, &id);
   MPI_Comm_size(MPI_COMM_WORLD, &p);
   
-  if(argc != 2) {
-   if(!id) printf("Command line: %s <m>\n", argv[0]);
+  for(i = 2; i < argc; i++)
+    if(!strcmp(argv[i], "-cache") && i + 1 < argc) cache = argv[++i];
+    else if(!strcmp(argv[i], "-lmo")) lmo = 1;
+    else if(!strcmp(argv[i], "-check")) lmo = check = 1;
+    else break;
+  if(argc < 2 || i < argc) {
+   if(!id) printf("Command line: %s <m> [-cache file] [-lmo | -check]\n", argv[0]);
    MPI_Finalize();
    exit(1);
   }
   
-  n = atoi(argv[1]);
+  n = atoll(argv[1]);
   
   /* Figure out this process's share of the array,
    * as well as the integers represented by the first
@@ -75,94 +786,44 @@ int main(int argc, char * argv[]) {
    */
   low_value = 2 + BLOCK_LOW(id, p, n - 1);
   high_value = 2 + BLOCK_HIGH(id, p, n - 1);
-  size = BLOCK_SIZE(id, p, n - 1);
-  
-  /* Bail out if all the primes used for sieving 
-   * are not all held by process 0
-   */
-  proc0_size = (n - 1)/p;
-  
-  /* Algorithm works only if the square of the largest value
-   * in process 0's array is greater than the upper limit of the
-   * sieve.
-   */
-  if((2 + proc0_size) < (int) sqrt((double)n)) {
-   if(!id) printf("Too many processes\n") ;
-   MPI_Finalize();
-   exit(1);
-  }
+  first = low_value | 1;
+  m = high_value >= first ? (high_value - first) / 2 + 1 : 0;
   
-  /* Allocate the process's share of the array 
-   * Single byte is the smallest unit if memory
-   * that can be indexed in C, so declare the array
-   * to be of type char.
-   */
-  marked = (char *) malloc(size);
+  /* Every process finds the sieving primes itself */
+  root = lmo && !check ? 0 : (int) integer_root(n, 2);
+  nprimes = sieving_primes(root, &primes);
+  pattern = wheel_pattern();
   
-  if(marked == NULL) {
+  if(primes == NULL || pattern == NULL) {
    printf("Cannot allocate enough memory\n");
    MPI_Finalize();
    exit(1);
   }
   
-  /* Unmark list of elements */
-  for(i = 0; i < size; i++) marked[i] = 0;
-  if(!id) index = 0;
-  prime = 2;
-  
-  do {
-    if(prime * prime > low_value)
-      first = prime * prime - low_value;
-    else {
-      if(!(low_value % prime)) first = 0;
-      else first = prime - (low_value % prime);
-    }
-    /* Start actual sieving 
-     * Each process marks the multiples
-     * of the current prime number from the
-     * first index through the end of the
-     * array.
-     */
-    for(i = first; i < size; i += prime) marked[i] = 1;
+  if(lmo) {
+    lmo_time = -MPI_Wtime();
+    lmo_count = prime_count_lmo(n, pattern, &threads, MPI_COMM_WORLD);
+    lmo_time += MPI_Wtime();
+  }
+  if(lmo && !check)
+    global_count = lmo_count;
+  else if(cache != NULL)
+    global_count = count_with_cache(n, cache, primes, nprimes, pattern, &threads, MPI_COMM_WORLD);
+  else {
+    /* Each thread counts the primes in its part of the odd values */
+    count = sieve_threads(first, m, primes, nprimes, pattern, NULL, &threads);
     
-    /* Process 0 finds the next prime by locating 
-     * the next unamrked location in the array.
-     */
-    if(!id) {
-     while (marked[++index]);
-     prime = index + 2;
-    }
-    /* Process 0 broadcasts the value of the next prime
-     * to the other processes
-     * 
-     * int MPI_Bcast (
-     * 	void *buffer,		// Addr of 1st broadcast element
-     * 	int count,		// Number of elements to broadcast
-     * 	MPI_Datatype datatype,	// Type of elements to broadcast
-     * 	int root,		// ID of process doing broadcast
-     * 	MPI_Comm comm		// Communicator
-     * )
-     */
-    MPI_Bcast(&prime, 1, MPI_INT, 0, MPI_COMM_WORLD);
-  
-    /* The process continue to sieve as long as the square
-     * of the current prime is less than or equal to the
-     * upper limit
-     */
-  } while(prime * prime <= n);
-  
-  /* Each process counts the number of primes in its portion
-   * of the list.
-   */
-  count = 0;
-  for(i = 0; i < size; i++)
-    if(!marked[i]) count++;
+    /* 2 is the one even prime */
+    if(low_value <= 2 && high_value >= 2) count++;
     
-  /* The process compute the grand total
-   * with the result being stored in variable
-   * global_count on process 0
-   */
-  MPI_Reduce(&count, &global_count, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    /* The process compute the grand total
+     * with the result being stored in variable
+     * global_count on process 0
+     */
+    MPI_Reduce(&count, &global_count, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  }
+  free(primes);
+  free(pattern);
   
   /* Stop the timer */
   elapsed_time += MPI_Wtime();
@@ -171,11 +832,14 @@ int main(int argc, char * argv[]) {
    * Process 0 prints the answer and elapsed time
    */
   if(!id) {
-   printf("%d primes are less than or equal to %d\n", global_count, n);
+   if(lmo) printf("Meissel-Lehmer (LMO) count in %10.6f seconds\n", lmo_time);
+   if(check) printf("Sieve check: %lld, %s\n", global_count, global_count == lmo_count ? "agrees" : "DIFFERS");
+   printf("%lld primes are less than or equal to %lld\n", lmo ? lmo_count : global_count, n);
    printf("Total elapsed time: %10.6f\n", elapsed_time);
+   printf("%d processes, %d threads each\n", p, threads);
   }
   
   MPI_Finalize();
   
   exit(0);
-}
\ No newline at end of file
+}
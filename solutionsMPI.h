@@ -0,0 +1,212 @@
+
+#ifndef SOLUTIONS_MPI
+#define SOLUTIONS_MPI
+
+/* Solution buffers, Version 1
+ *
+ * The circuit satisfiability programs keep the assignments
+ * they find in a per-process buffer, one 64-bit mask per
+ * assignment (bit i is input i), instead of printing each
+ * one as it is found. At the end 'output_solutions' gathers
+ * them on process 0 to print, and/or writes them to a file
+ * in parallel with MPI-IO, each process at the offset given
+ * by the solutions of the ranks below it:
+ * - a name ending in ".txt" gets one line of '0'/'1' per
+ *   assignment, input 0 first
+ * - any other name gets the raw 64-bit masks
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mpi.h>
+
+#define SOLUTIONS_INITIAL	64	/* First capacity of a buffer */
+#ifndef SOLUTIONS_CHUNK
+#define SOLUTIONS_CHUNK		(1 << 30)	/* Bytes per collective write */
+#endif
+
+typedef struct {
+  uint64_t *mask;	/* Assignments found */
+  long count;		/* How many */
+  long capacity;	/* Room for */
+} solution_buffer;
+
+void init_solutions(solution_buffer *s)
+{
+  s->mask = NULL;
+  s->count = 0;
+  s->capacity = 0;
+}
+
+void free_solutions(solution_buffer *s)
+{
+  free(s->mask);
+  init_solutions(s);
+}
+
+/*
+ * Append assignment 'z', doubling the buffer when full
+ */
+void add_solution(solution_buffer *s, uint64_t z)
+{
+  if(s->count == s->capacity) {
+    s->capacity = s->capacity ? 2 * s->capacity : SOLUTIONS_INITIAL;
+    s->mask = realloc(s->mask, s->capacity * sizeof(uint64_t));
+    if(s->mask == NULL) {
+      printf("Not enough memory for %ld solutions\n", s->capacity);
+      fflush(stdout);
+      MPI_Abort(MPI_COMM_WORLD, -2);
+    }
+  }
+  s->mask[s->count++] = z;
+}
+
+/*
+ * Write 'vars' bits of 'z' as '0'/'1' characters and a
+ * newline
+ */
+void format_solution(uint64_t z, int vars, char *line)
+{
+  int i;
+
+  for(i = 0; i < vars; i++) line[i] = (z >> i) & 1 ? '1' : '0';
+  line[vars] = '\n';
+}
+
+/*
+ * Write every process's solutions to 'name' with MPI-IO,
+ * in rank order. Without large counts (MPI < 4) the bytes go
+ * in rounds of at most SOLUTIONS_CHUNK, as many rounds on
+ * every process as the largest share needs
+ */
+void write_solutions(
+  solution_buffer *s,	/* IN - This process's solutions */
+  int vars,		/* IN - Inputs per assignment */
+  const char *name,	/* IN - File */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  MPI_File f;
+  long long below = 0;	/* Solutions of lower ranks */
+  long long mine = s->count;
+  long long bytes;	/* This process's share */
+#if MPI_VERSION < 4
+  long long most;	/* Largest share */
+  long long done, part;
+#endif
+  size_t len = strlen(name);
+  int text;		/* Text or binary file */
+  int record;		/* Bytes per solution */
+  char *out;
+  long i;
+  int id;
+
+  MPI_Comm_rank(comm, &id);
+  text = len > 4 && !strcmp(name + len - 4, ".txt");
+  record = text ? vars + 1 : (int) sizeof(uint64_t);
+  MPI_Exscan(&mine, &below, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  if(!id) below = 0;
+
+  if(text) {
+    out = malloc((size_t) s->count * record + 1);
+    for(i = 0; i < s->count; i++) format_solution(s->mask[i], vars, out + (size_t) i * record);
+  } else out = (char *) s->mask;
+
+  MPI_File_open(comm, (char *) name, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &f);
+  MPI_File_set_size(f, 0);
+  bytes = (long long) s->count * record;
+#if MPI_VERSION >= 4
+  MPI_File_write_at_all_c(f, (MPI_Offset) below * record, out, (MPI_Count) bytes, MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+#else
+  MPI_Allreduce(&bytes, &most, 1, MPI_LONG_LONG, MPI_MAX, comm);
+  for(done = 0; done < most; done += SOLUTIONS_CHUNK) {
+    part = bytes - done;
+    if(part < 0) part = 0;
+    if(part > SOLUTIONS_CHUNK) part = SOLUTIONS_CHUNK;
+    MPI_File_write_at_all(f, (MPI_Offset) (below * record + done), out + (part ? done : 0), (int) part,
+                          MPI_BYTE, MPI_STATUS_IGNORE);
+  }
+#endif
+  MPI_File_close(&f);
+  if(text) free(out);
+}
+
+/*
+ * Gather the solutions on process 0 and print them, each
+ * preceded by the rank that found it
+ */
+void print_solutions(
+  solution_buffer *s,	/* IN - This process's solutions */
+  int vars,		/* IN - Inputs per assignment */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  int *cnt, *disp;	/* Solutions of each process */
+  int mine = (int) s->count;
+  uint64_t *all = NULL;
+  char line[65];
+  int i, j, k, id, p;
+
+  MPI_Comm_rank(comm, &id);
+  MPI_Comm_size(comm, &p);
+  cnt = malloc(2 * p * sizeof(int));
+  disp = cnt + p;
+  MPI_Gather(&mine, 1, MPI_INT, cnt, 1, MPI_INT, 0, comm);
+  if(!id) {
+    for(disp[0] = 0, i = 1; i < p; i++) disp[i] = disp[i - 1] + cnt[i - 1];
+    all = malloc(((size_t) disp[p - 1] + cnt[p - 1] + 1) * sizeof(uint64_t));
+  }
+  MPI_Gatherv(s->mask, mine, MPI_UINT64_T, all, cnt, disp, MPI_UINT64_T, 0, comm);
+  if(!id) {
+    for(k = i = 0; i < p; i++)
+      for(j = 0; j < cnt[i]; j++, k++) {
+	format_solution(all[k], vars, line);
+	line[vars] = '\0';
+	printf("%d) %s\n", i, line);
+      }
+    fflush(stdout);
+    free(all);
+  }
+  free(cnt);
+}
+
+/*
+ * Print and/or write the solutions; returns the total
+ * found by all processes.
+ *
+ * All processes must invoke this function together
+ */
+long long output_solutions(
+  solution_buffer *s,	/* IN - This process's solutions */
+  int vars,		/* IN - Inputs per assignment */
+  int print,		/* IN - Print them on process 0 */
+  const char *name,	/* IN - File, or NULL */
+  MPI_Comm comm)	/* IN - Communicator */
+{
+  long long mine = s->count, total;
+
+  if(print) print_solutions(s, vars, comm);
+  if(name != NULL) write_solutions(s, vars, name, comm);
+  MPI_Allreduce(&mine, &total, 1, MPI_LONG_LONG, MPI_SUM, comm);
+  return total;
+}
+
+/*
+ * Read the options shared by the circuit programs:
+ * '-print', '-quiet' and '-o file'
+ */
+void solution_options(int argc, char *argv[], int *print, char **name)
+{
+  int i;
+
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "-print")) *print = 1;
+    else if(!strcmp(argv[i], "-quiet")) *print = 0;
+    else if(!strcmp(argv[i], "-o") && i + 1 < argc) *name = argv[++i];
+  }
+}
+
+#endif
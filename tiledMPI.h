@@ -0,0 +1,200 @@
+
+#ifndef TILED_MPI
+#define TILED_MPI
+
+/* Tiled matrix container, Version 1
+ *
+ * A file holds:
+ * - a TILED_HEADER-byte 'tiled_header': magic, version, byte
+ *   order, element type and size, dimensions, tile shape and
+ *   compression
+ * - the index: one 'tiled_entry' per tile, the tiles in
+ *   row-major order of the tile grid, giving the offset and
+ *   length of the tile's payload and the CRC-32 of its bytes
+ * - the payloads: each tile's elements row by row (tiles on
+ *   the last row or column of the grid are smaller), raw, or
+ *   coded by compressMPI.h with a leading code byte
+ * Numbers in the header and index, and raw elements, are in
+ * the writer's byte order, which 'order' records; a reader
+ * of the other order swaps them. A process reads only the
+ * tiles its block overlaps, each at the offset the index
+ * gives.
+ *
+ * Last modification: 18 October 2026
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include "compressMPI.h"
+
+#define TILED_MAGIC		"TILEDMAT"
+#define TILED_VERSION		1
+#define TILED_ORDER		0x01020304u	/* Reads back as written */
+#define TILED_HEADER		64		/* Bytes before the index */
+
+/* Element types */
+#define TILED_CHAR		1
+#define TILED_INT		2
+#define TILED_FLOAT		3
+#define TILED_DOUBLE		4
+
+/* Start of a tiled file */
+typedef struct {
+  char magic[8];	/* TILED_MAGIC */
+  uint32_t version;	/* TILED_VERSION */
+  uint32_t order;	/* TILED_ORDER, in the writer's byte order */
+  int32_t type;		/* TILED_... */
+  int32_t elem_size;	/* Bytes per element */
+  int64_t m, n;		/* Rows and columns */
+  int32_t tile_rows;	/* Tile shape */
+  int32_t tile_cols;
+  int32_t compression;	/* COMPRESS_... */
+  int32_t reserved;
+  int64_t index;	/* Offset of the index */
+} tiled_header;
+
+/* Where a tile is */
+typedef struct {
+  int64_t offset;	/* Of its payload */
+  int64_t bytes;	/* Payload length */
+  uint32_t crc;		/* CRC-32 of the payload */
+  uint32_t reserved;
+} tiled_entry;
+
+/*
+ * CRC-32 (IEEE 802.3, as zlib) of 'len' bytes, continuing
+ * from 'crc' (0 to start)
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t len)
+{
+  static uint32_t table[256];
+  const unsigned char *b = (const unsigned char *) data;
+  uint32_t c;
+  int i, k;
+
+  if(!table[1])
+    for(i = 0; i < 256; i++) {
+      for(c = (uint32_t) i, k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  crc = ~crc;
+  while(len--) crc = table[(crc ^ *b++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+/*
+ * Reverse the bytes of each of 'n' elements of 'width'
+ * bytes
+ */
+void swap_bytes(void *v, size_t n, size_t width)
+{
+  unsigned char *b = (unsigned char *) v, t;
+  size_t i, j;
+
+  if(width < 2) return;
+  for(i = 0; i < n; i++, b += width)
+    for(j = 0; j < width / 2; j++) {
+      t = b[j];
+      b[j] = b[width - 1 - j];
+      b[width - 1 - j] = t;
+    }
+}
+
+/*
+ * Check a header just read, swapping its numbers if it was
+ * written in the other byte order. Returns 0 for a file that
+ * is not tiled, 1 for one in this order, 2 for the other
+ */
+int tiled_check_header(tiled_header *h)
+{
+  uint32_t order = h->order;
+
+  if(memcmp(h->magic, TILED_MAGIC, 8)) return 0;
+  if(order == TILED_ORDER) return 1;
+  swap_bytes(&order, 1, 4);
+  if(order != TILED_ORDER) return 0;
+  swap_bytes(&h->version, 4, 4);	/* version, order, type, elem_size */
+  swap_bytes(&h->m, 2, 8);
+  swap_bytes(&h->tile_rows, 4, 4);	/* tile_rows, tile_cols, compression, reserved */
+  swap_bytes(&h->index, 1, 8);
+  return 2;
+}
+
+void tiled_swap_index(tiled_entry *index, size_t tiles)
+{
+  size_t t;
+
+  for(t = 0; t < tiles; t++) {
+    swap_bytes(&index[t].offset, 2, 8);
+    swap_bytes(&index[t].crc, 2, 4);
+  }
+}
+
+/*
+ * Tiles down and across
+ */
+void tiled_grid(tiled_header *h, long long *down, long long *across)
+{
+  *down = (h->m + h->tile_rows - 1) / h->tile_rows;
+  *across = (h->n + h->tile_cols - 1) / h->tile_cols;
+}
+
+/*
+ * Rows and columns of tile ('ti', 'tj')
+ */
+void tiled_shape(tiled_header *h, long long ti, long long tj, int *rows, int *cols)
+{
+  *rows = (int) (ti * h->tile_rows + h->tile_rows <= h->m ? h->tile_rows : h->m - ti * h->tile_rows);
+  *cols = (int) (tj * h->tile_cols + h->tile_cols <= h->n ? h->tile_cols : h->n - tj * h->tile_cols);
+}
+
+/*
+ * Payload of the 'count' elements of a tile: the elements
+ * themselves without compression, else a compressMPI.h
+ * payload. 'out' must hold compress_bound(count, width)
+ * bytes and 'tmp' count * width bytes. Returns its length
+ */
+size_t encode_tile(
+  const void *v,	/* IN - Elements, row by row */
+  size_t count,		/* IN - How many */
+  tiled_header *h,	/* IN - Type and compression */
+  unsigned char *out,	/* OUT - Payload */
+  unsigned char *tmp)	/* IN - Work space */
+{
+  if(h->compression == COMPRESS_NONE) {
+    memcpy(out, v, count * h->elem_size);
+    return count * h->elem_size;
+  }
+  return compress_payload(v, count, h->elem_size, h->type == TILED_INT, h->compression, out, tmp);
+}
+
+/*
+ * Elements of a tile from its payload, in this machine's
+ * byte order. The payload is changed when 'swapped'. 'tmp'
+ * must hold count * elem_size bytes
+ */
+void decode_tile(
+  unsigned char *in,	/* IN - Payload */
+  size_t len,		/* IN - Its length */
+  size_t count,		/* IN - Elements */
+  tiled_header *h,	/* IN - Type and compression */
+  int swapped,		/* IN - Written in the other byte order */
+  void *v,		/* OUT - Elements, row by row */
+  unsigned char *tmp)	/* IN - Work space */
+{
+  if(h->compression == COMPRESS_NONE) {
+    memcpy(v, in, count * h->elem_size);
+    if(swapped) swap_bytes(v, count, h->elem_size);
+    return;
+  }
+
+  /* Rounded values are swapped before widening; raw and
+   * shuffled bytes after; varints are byte order free
+   */
+  if(swapped && in[0] == CODE_FLOAT) swap_bytes(in + 1, count, 4);
+  if(swapped && in[0] == CODE_BF16) swap_bytes(in + 1, count, 2);
+  decompress_payload(in, len, count, h->elem_size, v, tmp);
+  if(swapped && (in[0] == CODE_RAW || in[0] == CODE_SHUFFLE_RLE)) swap_bytes(v, count, h->elem_size);
+}
+
+#endif